@@ -1,7 +1,13 @@
 #pragma once
 
+#include "frustum_culling_context.h"
 #include "maths.h"
+#include "occlusion_buffer.h"
+#include "primitive_bitset.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <vector>
 
 class AccelerationStructurePrimitive {
@@ -10,21 +16,181 @@ public:
         return m_bounds;
     }
 
+    // Stable index of the primitive assigned by its owner. Serialized acceleration structures refer to primitives by it.
+    uint32_t get_id() const {
+        return m_id;
+    }
+
 protected:
     aabbox3 m_bounds;
-    void* m_node;
+    void* m_node = nullptr;
+    uint32_t m_id;
 
     friend class LinearAccelerationStructure;
     friend class OctreeAccelerationStructure;
     friend class QuadtreeAccelerationStructure;
+    friend class StaticBvh;
+    friend class StaticDynamicAccelerationStructure;
+    friend class SweepAndPruneAccelerationStructure;
+};
+
+// Primitive touched by a moving box, `time` is the fraction of the box's displacement when they first touch.
+struct AccelerationStructureImpact {
+    AccelerationStructurePrimitive* primitive;
+    float time;
 };
 
+constexpr size_t DISTANCE_BUCKET_COUNT = 64;
+
+// Each bucket covers squared distances within a power of two. The nearest bucket holds boxes containing the camera.
+inline uint32_t get_distance_bucket(const aabbox3& bounds, const float3& camera_position) {
+    float distance = distance_squared(camera_position, bounds);
+    if (distance == 0.f) {
+        return 0;
+    }
+
+    int exponent;
+    std::frexp(distance, &exponent);
+    return static_cast<uint32_t>(std::min(std::max(exponent + 16, 1), static_cast<int>(DISTANCE_BUCKET_COUNT) - 1));
+}
+
+// Stable counting sort by distance bucket of the primitives starting at `first`, so the order within a bucket is kept.
+inline void sort_front_to_back(std::vector<AccelerationStructurePrimitive*>& output, size_t first, const float3& camera_position) {
+    size_t count = output.size() - first;
+    if (count < 2) {
+        return;
+    }
+
+    std::vector<uint8_t> buckets(count);
+    size_t offsets[DISTANCE_BUCKET_COUNT] = {};
+
+    for (size_t i = 0; i < count; i++) {
+        buckets[i] = static_cast<uint8_t>(get_distance_bucket(output[first + i]->get_bounds(), camera_position));
+        offsets[buckets[i]]++;
+    }
+
+    size_t offset = 0;
+    for (size_t& bucket_offset : offsets) {
+        size_t bucket_count = bucket_offset;
+        bucket_offset = offset;
+        offset += bucket_count;
+    }
+
+    std::vector<AccelerationStructurePrimitive*> sorted(count);
+    for (size_t i = 0; i < count; i++) {
+        sorted[offsets[buckets[i]]++] = output[first + i];
+    }
+
+    std::copy(sorted.begin(), sorted.end(), output.begin() + first);
+}
+
 class AccelerationStructure {
 public:
+    virtual ~AccelerationStructure() = default;
+
     virtual void add(AccelerationStructurePrimitive& primitive) = 0;
     virtual void remove(AccelerationStructurePrimitive& primitive) = 0;
     virtual void update(AccelerationStructurePrimitive& primitive) = 0;
 
     virtual void query(const aabbox3& aabbox, std::vector<AccelerationStructurePrimitive*>& output) const = 0;
     virtual void query(const frustum& frustum, std::vector<AccelerationStructurePrimitive*>& output) const = 0;
+
+    // Sets bits of primitives that intersect the box, the bitset must cover all primitive ids. Acceleration structures may
+    // output nodes that are entirely inside of the query without testing their primitives.
+    virtual void query(const aabbox3& aabbox, PrimitiveBitset& output) const {
+        std::vector<AccelerationStructurePrimitive*> primitives;
+        query(aabbox, primitives);
+
+        for (AccelerationStructurePrimitive* primitive : primitives) {
+            output.set(primitive->get_id());
+        }
+    }
+
+    virtual void query(const frustum& frustum, PrimitiveBitset& output) const {
+        std::vector<AccelerationStructurePrimitive*> primitives;
+        query(frustum, primitives);
+
+        for (AccelerationStructurePrimitive* primitive : primitives) {
+            output.set(primitive->get_id());
+        }
+    }
+
+    // Outputs ids of primitives that intersect the box.
+    virtual void query(const aabbox3& aabbox, std::vector<uint32_t>& output) const {
+        std::vector<AccelerationStructurePrimitive*> primitives;
+        query(aabbox, primitives);
+
+        for (AccelerationStructurePrimitive* primitive : primitives) {
+            output.push_back(primitive->get_id());
+        }
+    }
+
+    virtual void query(const frustum& frustum, std::vector<uint32_t>& output) const {
+        std::vector<AccelerationStructurePrimitive*> primitives;
+        query(frustum, primitives);
+
+        for (AccelerationStructurePrimitive* primitive : primitives) {
+            output.push_back(primitive->get_id());
+        }
+    }
+
+    // Outputs primitives that the box touches while it moves by the displacement, with the time of the first touch.
+    // Acceleration structures may only look for candidates within the bounds of the whole sweep.
+    virtual void query(const aabbox3& aabbox, const float3& displacement, std::vector<AccelerationStructureImpact>& output) const {
+        std::vector<AccelerationStructurePrimitive*> candidates;
+        query(get_swept_bounds(aabbox, displacement), candidates);
+
+        for (AccelerationStructurePrimitive* candidate : candidates) {
+            float time;
+            if (intersect(aabbox, displacement, candidate->get_bounds(), time)) {
+                output.push_back(AccelerationStructureImpact{ candidate, time });
+            }
+        }
+    }
+
+    // Outputs primitives that intersect each box to the output with the same index. Acceleration structures may visit
+    // their nodes once for all the boxes that intersect them.
+    virtual void query(const aabbox3* aabboxes, size_t count, std::vector<AccelerationStructurePrimitive*>* outputs) const {
+        for (size_t i = 0; i < count; i++) {
+            query(aabboxes[i], outputs[i]);
+        }
+    }
+
+    virtual void query(const frustum* frustums, size_t count, std::vector<AccelerationStructurePrimitive*>* outputs) const {
+        for (size_t i = 0; i < count; i++) {
+            query(frustums[i], outputs[i]);
+        }
+    }
+
+    // Outputs primitives that became visible or stopped being visible since the previous query with the same context.
+    // The context must be notified about primitives that were added, updated or removed in between.
+    virtual void query(const frustum& frustum, FrustumCullingContext& context, std::vector<AccelerationStructurePrimitive*>& added, std::vector<AccelerationStructurePrimitive*>& removed) const {
+        std::vector<AccelerationStructurePrimitive*> visible;
+        query(frustum, visible);
+        context.apply(visible, added, removed);
+    }
+
+    // Outputs primitives that intersect the frustum and aren't occluded. The occlusion buffer must be built for the same
+    // view as the frustum.
+    virtual void query(const frustum& frustum, const OcclusionBuffer& occlusion_buffer, std::vector<AccelerationStructurePrimitive*>& output) const {
+        size_t first = output.size();
+        query(frustum, output);
+
+        output.erase(std::remove_if(output.begin() + first, output.end(), [&occlusion_buffer](const AccelerationStructurePrimitive* primitive) {
+            return occlusion_buffer.is_occluded(primitive->get_bounds());
+        }), output.end());
+    }
+
+    // Outputs primitives that intersect the frustum and don't project smaller than `min_size`, approximately sorted
+    // from front to back. See `is_smaller` for `projection_scale`.
+    virtual void query(const frustum& frustum, const float3& camera_position, float projection_scale, float min_size, std::vector<AccelerationStructurePrimitive*>& output) const {
+        size_t first = output.size();
+        query(frustum, output);
+
+        output.erase(std::remove_if(output.begin() + first, output.end(), [&](const AccelerationStructurePrimitive* primitive) {
+            return is_smaller(primitive->get_bounds(), camera_position, projection_scale, min_size);
+        }), output.end());
+
+        sort_front_to_back(output, first, camera_position);
+    }
 };
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "acceleration_structure.h"
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Batches are split into jobs of this many queries, so a large batch is spread between threads.
+constexpr size_t ASYNC_QUERY_JOB_SIZE = 64;
+
+// Output of each query of a batch, in the order of submission.
+using AsyncQueryResult = std::vector<std::vector<AccelerationStructurePrimitive*>>;
+
+// Executes batches of queries on background threads. Queries of one job are executed with a single batch query, so
+// acceleration structures can share traversal between them.
+//
+// An acceleration structure must not be modified until all queries submitted for it are complete.
+class AsyncQueryQueue {
+public:
+    AsyncQueryQueue(size_t thread_count) {
+        assert(thread_count > 0);
+
+        for (size_t i = 0; i < thread_count; i++) {
+            m_threads.emplace_back(&AsyncQueryQueue::run, this);
+        }
+    }
+
+    AsyncQueryQueue(const AsyncQueryQueue&) = delete;
+    AsyncQueryQueue& operator=(const AsyncQueryQueue&) = delete;
+
+    // Pending jobs are completed before the threads are joined.
+    ~AsyncQueryQueue() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_is_stopping = true;
+        }
+
+        m_condition.notify_all();
+
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    std::future<AsyncQueryResult> submit(const AccelerationStructure& acceleration_structure, std::vector<aabbox3> aabboxes) {
+        std::shared_ptr<Batch> batch = std::make_shared<Batch>(acceleration_structure, aabboxes.size());
+        batch->aabboxes = std::move(aabboxes);
+        return submit(std::move(batch));
+    }
+
+    std::future<AsyncQueryResult> submit(const AccelerationStructure& acceleration_structure, std::vector<frustum> frustums) {
+        std::shared_ptr<Batch> batch = std::make_shared<Batch>(acceleration_structure, frustums.size());
+        batch->frustums = std::move(frustums);
+        return submit(std::move(batch));
+    }
+
+private:
+    struct Batch {
+        Batch(const AccelerationStructure& acceleration_structure_, size_t count)
+            : acceleration_structure(acceleration_structure_)
+            , outputs(count)
+            , remaining((count + ASYNC_QUERY_JOB_SIZE - 1) / ASYNC_QUERY_JOB_SIZE)
+        {
+        }
+
+        const AccelerationStructure& acceleration_structure;
+
+        // Only one of these is used.
+        std::vector<aabbox3> aabboxes;
+        std::vector<frustum> frustums;
+
+        AsyncQueryResult outputs;
+        std::promise<AsyncQueryResult> promise;
+
+        // Number of jobs that are not complete yet. The last one fulfills the promise.
+        std::atomic<size_t> remaining;
+
+        // The first exception thrown by a query, the promise is failed with it once all jobs are complete.
+        std::exception_ptr exception;
+        std::atomic<bool> has_exception{ false };
+    };
+
+    struct Job {
+        std::shared_ptr<Batch> batch;
+        size_t first;
+        size_t count;
+    };
+
+    std::future<AsyncQueryResult> submit(std::shared_ptr<Batch> batch) {
+        std::future<AsyncQueryResult> result = batch->promise.get_future();
+
+        size_t count = batch->outputs.size();
+        if (count == 0) {
+            batch->promise.set_value(AsyncQueryResult());
+            return result;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (size_t first = 0; first < count; first += ASYNC_QUERY_JOB_SIZE) {
+                m_jobs.push_back(Job{ batch, first, std::min(ASYNC_QUERY_JOB_SIZE, count - first) });
+            }
+        }
+
+        m_condition.notify_all();
+
+        return result;
+    }
+
+    void run() {
+        while (true) {
+            Job job;
+
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [this] { return m_is_stopping || !m_jobs.empty(); });
+
+                if (m_jobs.empty()) {
+                    return;
+                }
+
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+
+            Batch& batch = *job.batch;
+
+            try {
+                if (!batch.aabboxes.empty()) {
+                    batch.acceleration_structure.query(batch.aabboxes.data() + job.first, job.count, batch.outputs.data() + job.first);
+                } else {
+                    batch.acceleration_structure.query(batch.frustums.data() + job.first, job.count, batch.outputs.data() + job.first);
+                }
+            } catch (...) {
+                if (!batch.has_exception.exchange(true, std::memory_order_relaxed)) {
+                    batch.exception = std::current_exception();
+                }
+            }
+
+            // Other jobs' outputs and exception are visible to the last one, which moves them all into the result.
+            if (batch.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                if (batch.exception) {
+                    batch.promise.set_exception(batch.exception);
+                } else {
+                    batch.promise.set_value(std::move(batch.outputs));
+                }
+            }
+        }
+    }
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<Job> m_jobs;
+    bool m_is_stopping = false;
+};
@@ -0,0 +1,298 @@
+#pragma once
+
+#include "compact_tree.h"
+#include "count_allocator.h"
+#include "octree_acceleration_structure.h"
+
+#include <bitset>
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+// Immutable copy of an octree that hasn't grown. Must be rebuilt when the source octree changes.
+class CompactOctree {
+public:
+    CompactOctree(CountMemoryResource& memory_resource, const OctreeAccelerationStructure& octree)
+        : m_data(memory_resource)
+    {
+        // Child bounds are derived from the parent's, so nodes left over from growing the root can't be stored.
+        if (!is_regular(octree)) {
+            throw std::invalid_argument("Compact octree can't be built from a grown octree.");
+        }
+
+        uint32_t node_count = 1;
+        uint32_t primitive_count = 0;
+        measure(octree, node_count, primitive_count);
+
+        size_t node_offset = align_compact_tree_offset(sizeof(CompactTreeHeader));
+        size_t primitive_offset = align_compact_tree_offset(node_offset + node_count * sizeof(CompactTreeNode));
+
+        m_data.resize(primitive_offset + primitive_count * sizeof(CompactTreePrimitive));
+
+        CompactTreeHeader* header = reinterpret_cast<CompactTreeHeader*>(m_data.data());
+        header->magic = COMPACT_OCTREE_MAGIC;
+        header->version = COMPACT_TREE_VERSION;
+        header->node_count = node_count;
+        header->primitive_count = primitive_count;
+        header->node_offset = static_cast<uint32_t>(node_offset);
+        header->primitive_offset = static_cast<uint32_t>(primitive_offset);
+        header->bounds = octree.bounds;
+
+        CompactTreeNode* nodes = reinterpret_cast<CompactTreeNode*>(m_data.data() + node_offset);
+        CompactTreePrimitive* primitives = reinterpret_cast<CompactTreePrimitive*>(m_data.data() + primitive_offset);
+
+        uint32_t next_node = 1;
+        uint32_t next_primitive = 0;
+        build(octree, nodes, primitives, 0, next_node, next_primitive);
+
+        attach(m_data.data());
+
+        assert(next_node == node_count);
+        assert(next_primitive == primitive_count);
+    }
+
+    // Queries the given block directly, e.g. a mapped file. The block must outlive the compact octree.
+    // Throws if the block is invalid.
+    CompactOctree(CountMemoryResource& memory_resource, const void* data, size_t size)
+        : m_data(memory_resource)
+    {
+        if (!validate(data, size)) {
+            throw std::invalid_argument("Invalid compact octree.");
+        }
+
+        attach(data);
+    }
+
+    CompactOctree(const CompactOctree&) = delete;
+    CompactOctree& operator=(const CompactOctree&) = delete;
+
+    static bool validate(const void* data, size_t size) {
+        return validate_compact_tree(data, size, COMPACT_OCTREE_MAGIC, 8);
+    }
+
+    bool save(const char* path) const {
+        return save_compact_tree(path, m_header, get_compact_tree_size(*m_header));
+    }
+
+    // Queries that output primitive pointers look primitives up by their ids in the given table.
+    void set_primitives(AccelerationStructurePrimitive* const* primitives) {
+        m_table = primitives;
+    }
+
+    void query(const aabbox3& aabbox, std::vector<uint32_t>& output) const {
+        collect_primitives(m_nodes[0], m_header->bounds, aabbox, output);
+    }
+
+    void query(const frustum& frustum, std::vector<uint32_t>& output) const {
+        collect_primitives(m_nodes[0], m_header->bounds, frustum, output);
+    }
+
+    void query(const aabbox3& aabbox, PrimitiveBitset& output) const {
+        collect_primitives(m_nodes[0], m_header->bounds, aabbox, output);
+    }
+
+    void query(const frustum& frustum, PrimitiveBitset& output) const {
+        collect_primitives(m_nodes[0], m_header->bounds, frustum, output);
+    }
+
+    void query(const aabbox3& aabbox, std::vector<AccelerationStructurePrimitive*>& output) const {
+        assert(m_table != nullptr);
+        collect_primitives(m_nodes[0], m_header->bounds, aabbox, output);
+    }
+
+    void query(const frustum& frustum, std::vector<AccelerationStructurePrimitive*>& output) const {
+        assert(m_table != nullptr);
+        collect_primitives(m_nodes[0], m_header->bounds, frustum, output);
+    }
+
+private:
+    static bool is_empty(const OctreeNode& node) {
+        if (!node.primitives.empty()) {
+            return false;
+        }
+
+        for (const std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : node.children) {
+            if (child && !is_empty(*child)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static bool is_regular(const OctreeNode& node) {
+        for (uint32_t i = 0; i < 8; i++) {
+            const std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child = node.children[i];
+
+            if (child && !is_empty(*child) && ((node.irregular_children & (1 << i)) || !is_regular(*child))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static void measure(const OctreeNode& node, uint32_t& node_count, uint32_t& primitive_count) {
+        primitive_count += static_cast<uint32_t>(node.primitives.size());
+
+        for (const std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : node.children) {
+            if (child && !is_empty(*child)) {
+                node_count++;
+                measure(*child, node_count, primitive_count);
+            }
+        }
+    }
+
+    void attach(const void* data) {
+        m_header = static_cast<const CompactTreeHeader*>(data);
+        m_nodes = reinterpret_cast<const CompactTreeNode*>(static_cast<const char*>(data) + m_header->node_offset);
+        m_primitives = reinterpret_cast<const CompactTreePrimitive*>(static_cast<const char*>(data) + m_header->primitive_offset);
+    }
+
+    static void build(const OctreeNode& source, CompactTreeNode* nodes, CompactTreePrimitive* primitives, uint32_t index, uint32_t& next_node, uint32_t& next_primitive) {
+        CompactTreeNode& node = nodes[index];
+        node.first_primitive = next_primitive;
+        node.primitive_count = static_cast<uint32_t>(source.primitives.size());
+
+        for (AccelerationStructurePrimitive* primitive : source.primitives) {
+            primitives[next_primitive++] = CompactTreePrimitive{ primitive->get_bounds(), primitive->get_id() };
+        }
+
+        // Children are allocated before recursing, so they end up next to each other.
+        node.first_child = next_node;
+
+        for (uint32_t i = 0; i < 8; i++) {
+            if (source.children[i] && !is_empty(*source.children[i])) {
+                node.child_mask |= 1 << i;
+                next_node++;
+            }
+        }
+
+        uint32_t child_index = node.first_child;
+
+        for (uint32_t i = 0; i < 8; i++) {
+            if (node.child_mask & (1 << i)) {
+                build(*source.children[i], nodes, primitives, child_index++, next_node, next_primitive);
+            }
+        }
+    }
+
+    void push(std::vector<uint32_t>& output, const CompactTreePrimitive& primitive) const {
+        output.push_back(primitive.id);
+    }
+
+    void push(std::vector<AccelerationStructurePrimitive*>& output, const CompactTreePrimitive& primitive) const {
+        output.push_back(m_table[primitive.id]);
+    }
+
+    void push(PrimitiveBitset& output, const CompactTreePrimitive& primitive) const {
+        output.set(primitive.id);
+    }
+
+    template <typename T>
+    static void reserve(std::vector<T>& output, size_t count) {
+        output.reserve(output.size() + count);
+    }
+
+    // Bitsets are sized upfront.
+    static void reserve(PrimitiveBitset&, size_t) {
+    }
+
+    // Primitives of a node are within its bounds, except for the root which also holds primitives that don't fit.
+    static bool is_inside(const aabbox3& node_bounds, const aabbox3& aabbox) {
+        return node_bounds.center.x - node_bounds.extent.x >= aabbox.center.x - aabbox.extent.x &&
+               node_bounds.center.y - node_bounds.extent.y >= aabbox.center.y - aabbox.extent.y &&
+               node_bounds.center.z - node_bounds.extent.z >= aabbox.center.z - aabbox.extent.z &&
+               node_bounds.center.x + node_bounds.extent.x <= aabbox.center.x + aabbox.extent.x &&
+               node_bounds.center.y + node_bounds.extent.y <= aabbox.center.y + aabbox.extent.y &&
+               node_bounds.center.z + node_bounds.extent.z <= aabbox.center.z + aabbox.extent.z;
+    }
+
+    static bool is_inside(const aabbox3& node_bounds, const frustum& frustum) {
+        return contains(frustum, node_bounds);
+    }
+
+    // Primitives of a subtree are consecutive, so the whole subtree is output in one loop. The last of them belong to
+    // the last node of the subtree in depth first order.
+    template <typename Output>
+    void collect_all_primitives(const CompactTreeNode& node, Output& output) const {
+        const CompactTreeNode* last = &node;
+        while (last->child_mask != 0) {
+            last = &m_nodes[last->first_child + std::bitset<8>(last->child_mask).count() - 1];
+        }
+
+        push_range(output, node.first_primitive, last->first_primitive + last->primitive_count);
+    }
+
+    template <typename Output>
+    void push_range(Output& output, uint32_t first, uint32_t last) const {
+        reserve(output, last - first);
+
+        for (uint32_t i = first; i < last; i++) {
+            push(output, m_primitives[i]);
+        }
+    }
+
+    // Runs of consecutive ids, e.g. when primitives are numbered in the order of the compact octree, set whole words.
+    void push_range(PrimitiveBitset& output, uint32_t first, uint32_t last) const {
+        uint32_t i = first;
+
+        while (i < last) {
+            uint32_t id = m_primitives[i].id;
+            uint32_t count = 1;
+
+            while (i + count < last && m_primitives[i + count].id == id + count) {
+                count++;
+            }
+
+            output.set_range(id, id + count);
+            i += count;
+        }
+    }
+
+    template <typename Bounds, typename Output>
+    void collect_primitives(const CompactTreeNode& node, const aabbox3& node_bounds, const Bounds& bounds, Output& output) const {
+        reserve(output, node.primitive_count);
+
+        for (uint32_t i = node.first_primitive; i < node.first_primitive + node.primitive_count; i++) {
+            if (intersect(m_primitives[i].bounds, bounds)) {
+                push(output, m_primitives[i]);
+            }
+        }
+
+        float extent_x = node_bounds.extent.x / 2.f;
+        float extent_y = node_bounds.extent.y / 2.f;
+        float extent_z = node_bounds.extent.z / 2.f;
+
+        uint32_t child_index = node.first_child;
+
+        for (uint32_t i = 0; i < 8; i++) {
+            if (node.child_mask & (1 << i)) {
+                aabbox3 child_bounds{
+                    float3{
+                        node_bounds.center.x + OCTREE_EXTENT_FACTORS[i].x * extent_x,
+                        node_bounds.center.y + OCTREE_EXTENT_FACTORS[i].y * extent_y,
+                        node_bounds.center.z + OCTREE_EXTENT_FACTORS[i].z * extent_z
+                    },
+                    float3{ extent_x, extent_y, extent_z }
+                };
+
+                if (is_inside(child_bounds, bounds)) {
+                    collect_all_primitives(m_nodes[child_index], output);
+                } else if (intersect(child_bounds, bounds)) {
+                    collect_primitives(m_nodes[child_index], child_bounds, bounds, output);
+                }
+
+                child_index++;
+            }
+        }
+    }
+
+    // Owned block when built from an octree, empty when querying external memory.
+    std::vector<char, CountAllocator<char>> m_data;
+
+    const CompactTreeHeader* m_header = nullptr;
+    const CompactTreeNode* m_nodes = nullptr;
+    const CompactTreePrimitive* m_primitives = nullptr;
+    AccelerationStructurePrimitive* const* m_table = nullptr;
+};
@@ -0,0 +1,301 @@
+#pragma once
+
+#include "compact_tree.h"
+#include "count_allocator.h"
+#include "quadtree_acceleration_structure.h"
+
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+// Immutable copy of a quadtree that hasn't grown. Must be rebuilt when the source quadtree changes.
+class CompactQuadtree {
+public:
+    CompactQuadtree(CountMemoryResource& memory_resource, const QuadtreeAccelerationStructure& quadtree)
+        : m_data(memory_resource)
+    {
+        // Child bounds are derived from the parent's, so nodes left over from growing the root can't be stored.
+        if (!is_regular(quadtree)) {
+            throw std::invalid_argument("Compact quadtree can't be built from a grown quadtree.");
+        }
+
+        uint32_t node_count = 1;
+        uint32_t primitive_count = 0;
+        measure(quadtree, node_count, primitive_count);
+
+        size_t node_offset = align_compact_tree_offset(sizeof(CompactTreeHeader));
+        size_t primitive_offset = align_compact_tree_offset(node_offset + node_count * sizeof(CompactTreeNode));
+
+        m_data.resize(primitive_offset + primitive_count * sizeof(CompactTreePrimitive));
+
+        CompactTreeHeader* header = reinterpret_cast<CompactTreeHeader*>(m_data.data());
+        header->magic = COMPACT_QUADTREE_MAGIC;
+        header->version = COMPACT_TREE_VERSION;
+        header->node_count = node_count;
+        header->primitive_count = primitive_count;
+        header->node_offset = static_cast<uint32_t>(node_offset);
+        header->primitive_offset = static_cast<uint32_t>(primitive_offset);
+        header->bounds = aabbox3{
+            float3{ quadtree.bounds.center.x, 0.f, quadtree.bounds.center.y },
+            float3{ quadtree.bounds.extent.x, 0.f, quadtree.bounds.extent.y }
+        };
+
+        CompactTreeNode* nodes = reinterpret_cast<CompactTreeNode*>(m_data.data() + node_offset);
+        CompactTreePrimitive* primitives = reinterpret_cast<CompactTreePrimitive*>(m_data.data() + primitive_offset);
+
+        uint32_t next_node = 1;
+        uint32_t next_primitive = 0;
+        build(quadtree, nodes, primitives, 0, next_node, next_primitive);
+
+        attach(m_data.data());
+
+        assert(next_node == node_count);
+        assert(next_primitive == primitive_count);
+    }
+
+    // Queries the given block directly, e.g. a mapped file. The block must outlive the compact quadtree.
+    // Throws if the block is invalid.
+    CompactQuadtree(CountMemoryResource& memory_resource, const void* data, size_t size)
+        : m_data(memory_resource)
+    {
+        if (!validate(data, size)) {
+            throw std::invalid_argument("Invalid compact quadtree.");
+        }
+
+        attach(data);
+    }
+
+    CompactQuadtree(const CompactQuadtree&) = delete;
+    CompactQuadtree& operator=(const CompactQuadtree&) = delete;
+
+    static bool validate(const void* data, size_t size) {
+        return validate_compact_tree(data, size, COMPACT_QUADTREE_MAGIC, 4);
+    }
+
+    bool save(const char* path) const {
+        return save_compact_tree(path, m_header, get_compact_tree_size(*m_header));
+    }
+
+    // Queries that output primitive pointers look primitives up by their ids in the given table.
+    void set_primitives(AccelerationStructurePrimitive* const* primitives) {
+        m_table = primitives;
+    }
+
+    void query(const aabbox3& aabbox, std::vector<uint32_t>& output) const {
+        collect_primitives(m_nodes[0], m_bounds, aabbox, output);
+    }
+
+    void query(const frustum& frustum, std::vector<uint32_t>& output) const {
+        float y_center;
+        float y_extent;
+        QuadtreeAccelerationStructure::find_y_range(frustum, y_center, y_extent);
+
+        collect_primitives(m_nodes[0], m_bounds, frustum, y_center, y_extent, output);
+    }
+
+    void query(const aabbox3& aabbox, PrimitiveBitset& output) const {
+        collect_primitives(m_nodes[0], m_bounds, aabbox, output);
+    }
+
+    void query(const frustum& frustum, PrimitiveBitset& output) const {
+        float y_center;
+        float y_extent;
+        QuadtreeAccelerationStructure::find_y_range(frustum, y_center, y_extent);
+
+        collect_primitives(m_nodes[0], m_bounds, frustum, y_center, y_extent, output);
+    }
+
+    void query(const aabbox3& aabbox, std::vector<AccelerationStructurePrimitive*>& output) const {
+        assert(m_table != nullptr);
+        collect_primitives(m_nodes[0], m_bounds, aabbox, output);
+    }
+
+    void query(const frustum& frustum, std::vector<AccelerationStructurePrimitive*>& output) const {
+        assert(m_table != nullptr);
+
+        float y_center;
+        float y_extent;
+        QuadtreeAccelerationStructure::find_y_range(frustum, y_center, y_extent);
+
+        collect_primitives(m_nodes[0], m_bounds, frustum, y_center, y_extent, output);
+    }
+
+private:
+    static bool is_empty(const QuadtreeNode& node) {
+        if (!node.primitives.empty()) {
+            return false;
+        }
+
+        for (const std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>& child : node.children) {
+            if (child && !is_empty(*child)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static bool is_regular(const QuadtreeNode& node) {
+        for (uint32_t i = 0; i < 4; i++) {
+            const std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>& child = node.children[i];
+
+            if (child && !is_empty(*child) && ((node.irregular_children & (1 << i)) || !is_regular(*child))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static void measure(const QuadtreeNode& node, uint32_t& node_count, uint32_t& primitive_count) {
+        primitive_count += static_cast<uint32_t>(node.primitives.size());
+
+        for (const std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>& child : node.children) {
+            if (child && !is_empty(*child)) {
+                node_count++;
+                measure(*child, node_count, primitive_count);
+            }
+        }
+    }
+
+    void attach(const void* data) {
+        m_header = static_cast<const CompactTreeHeader*>(data);
+        m_nodes = reinterpret_cast<const CompactTreeNode*>(static_cast<const char*>(data) + m_header->node_offset);
+        m_primitives = reinterpret_cast<const CompactTreePrimitive*>(static_cast<const char*>(data) + m_header->primitive_offset);
+        m_bounds = aabbox2{
+            float2{ m_header->bounds.center.x, m_header->bounds.center.z },
+            float2{ m_header->bounds.extent.x, m_header->bounds.extent.z }
+        };
+    }
+
+    static void build(const QuadtreeNode& source, CompactTreeNode* nodes, CompactTreePrimitive* primitives, uint32_t index, uint32_t& next_node, uint32_t& next_primitive) {
+        CompactTreeNode& node = nodes[index];
+        node.first_primitive = next_primitive;
+        node.primitive_count = static_cast<uint32_t>(source.primitives.size());
+
+        for (AccelerationStructurePrimitive* primitive : source.primitives) {
+            primitives[next_primitive++] = CompactTreePrimitive{ primitive->get_bounds(), primitive->get_id() };
+        }
+
+        // Children are allocated before recursing, so they end up next to each other.
+        node.first_child = next_node;
+
+        for (uint32_t i = 0; i < 4; i++) {
+            if (source.children[i] && !is_empty(*source.children[i])) {
+                node.child_mask |= 1 << i;
+                next_node++;
+            }
+        }
+
+        uint32_t child_index = node.first_child;
+
+        for (uint32_t i = 0; i < 4; i++) {
+            if (node.child_mask & (1 << i)) {
+                build(*source.children[i], nodes, primitives, child_index++, next_node, next_primitive);
+            }
+        }
+    }
+
+    void push(std::vector<uint32_t>& output, const CompactTreePrimitive& primitive) const {
+        output.push_back(primitive.id);
+    }
+
+    void push(std::vector<AccelerationStructurePrimitive*>& output, const CompactTreePrimitive& primitive) const {
+        output.push_back(m_table[primitive.id]);
+    }
+
+    void push(PrimitiveBitset& output, const CompactTreePrimitive& primitive) const {
+        output.set(primitive.id);
+    }
+
+    template <typename T>
+    static void reserve(std::vector<T>& output, size_t count) {
+        output.reserve(output.size() + count);
+    }
+
+    // Bitsets are sized upfront.
+    static void reserve(PrimitiveBitset&, size_t) {
+    }
+
+    template <typename Output>
+    void collect_primitives(const CompactTreeNode& node, const aabbox2& node_bounds, const aabbox3& bounds, Output& output) const {
+        reserve(output, node.primitive_count);
+
+        for (uint32_t i = node.first_primitive; i < node.first_primitive + node.primitive_count; i++) {
+            if (intersect(m_primitives[i].bounds, bounds)) {
+                push(output, m_primitives[i]);
+            }
+        }
+
+        float extent_x = node_bounds.extent.x / 2.f;
+        float extent_y = node_bounds.extent.y / 2.f;
+
+        uint32_t child_index = node.first_child;
+
+        for (uint32_t i = 0; i < 4; i++) {
+            if (node.child_mask & (1 << i)) {
+                aabbox2 child_bounds{
+                    float2{
+                        node_bounds.center.x + QUADTREE_EXTENT_FACTORS[i].x * extent_x,
+                        node_bounds.center.y + QUADTREE_EXTENT_FACTORS[i].y * extent_y
+                    },
+                    float2{ extent_x, extent_y }
+                };
+
+                if (intersect(child_bounds, bounds)) {
+                    collect_primitives(m_nodes[child_index], child_bounds, bounds, output);
+                }
+
+                child_index++;
+            }
+        }
+    }
+
+    template <typename Output>
+    void collect_primitives(const CompactTreeNode& node, const aabbox2& node_bounds, const frustum& bounds, float y_center, float y_extent, Output& output) const {
+        reserve(output, node.primitive_count);
+
+        for (uint32_t i = node.first_primitive; i < node.first_primitive + node.primitive_count; i++) {
+            if (intersect(m_primitives[i].bounds, bounds)) {
+                push(output, m_primitives[i]);
+            }
+        }
+
+        float extent_x = node_bounds.extent.x / 2.f;
+        float extent_y = node_bounds.extent.y / 2.f;
+
+        uint32_t child_index = node.first_child;
+
+        for (uint32_t i = 0; i < 4; i++) {
+            if (node.child_mask & (1 << i)) {
+                aabbox2 child_bounds{
+                    float2{
+                        node_bounds.center.x + QUADTREE_EXTENT_FACTORS[i].x * extent_x,
+                        node_bounds.center.y + QUADTREE_EXTENT_FACTORS[i].y * extent_y
+                    },
+                    float2{ extent_x, extent_y }
+                };
+
+                aabbox3 child_bounds_3d{
+                    float3{ child_bounds.center.x, y_center, child_bounds.center.y },
+                    float3{ child_bounds.extent.x, y_extent, child_bounds.extent.y }
+                };
+
+                if (intersect(child_bounds_3d, bounds)) {
+                    collect_primitives(m_nodes[child_index], child_bounds, bounds, y_center, y_extent, output);
+                }
+
+                child_index++;
+            }
+        }
+    }
+
+    // Owned block when built from a quadtree, empty when querying external memory.
+    std::vector<char, CountAllocator<char>> m_data;
+
+    const CompactTreeHeader* m_header = nullptr;
+    const CompactTreeNode* m_nodes = nullptr;
+    const CompactTreePrimitive* m_primitives = nullptr;
+    AccelerationStructurePrimitive* const* m_table = nullptr;
+    aabbox2 m_bounds;
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "maths.h"
+
+#include <bitset>
+#include <cstdint>
+#include <cstdio>
+
+constexpr uint32_t COMPACT_OCTREE_MAGIC = 0x4F435341;   // "ASCO"
+constexpr uint32_t COMPACT_QUADTREE_MAGIC = 0x51435341; // "ASCQ"
+constexpr uint32_t COMPACT_TREE_VERSION = 1;
+constexpr size_t COMPACT_TREE_ALIGNMENT = 16;
+
+// A compact tree is one relocatable block of memory: a header followed by nodes and primitives, which refer to each
+// other by index only. The same block is queried in memory, saved to a file, and queried straight from a mapped file.
+struct CompactTreeHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t node_count;
+    uint32_t primitive_count;
+
+    // Offsets from the beginning of the block.
+    uint32_t node_offset;
+    uint32_t primitive_offset;
+
+    // Quadtree bounds are stored in X and Z.
+    aabbox3 bounds;
+};
+
+// Node bounds are not stored, they're derived from the root bounds and the path to the node.
+struct CompactTreeNode {
+    // Children present in `child_mask` are stored contiguously starting at `first_child`, in child index order.
+    uint32_t first_child;
+
+    // Node's primitives are `primitive_count` consecutive entries of the shared primitive array.
+    uint32_t first_primitive;
+    uint32_t primitive_count;
+
+    uint8_t child_mask;
+};
+
+static_assert(sizeof(CompactTreeNode) == 16, "Four compact tree nodes must fit a cache line.");
+
+// Bounds are copied, so queries don't touch the primitives themselves.
+struct CompactTreePrimitive {
+    aabbox3 bounds;
+    uint32_t id;
+};
+
+inline size_t align_compact_tree_offset(size_t offset) {
+    return (offset + COMPACT_TREE_ALIGNMENT - 1) / COMPACT_TREE_ALIGNMENT * COMPACT_TREE_ALIGNMENT;
+}
+
+inline size_t get_compact_tree_size(const CompactTreeHeader& header) {
+    return header.primitive_offset + static_cast<size_t>(header.primitive_count) * sizeof(CompactTreePrimitive);
+}
+
+// Checks the header and every node, so queries stay within the block. Children must follow their parent and primitives
+// of children must follow the parent's, as they're written in depth first order. Primitive ids are not checked, they
+// must be covered by the output bitset or the primitive table.
+inline bool validate_compact_tree(const void* data, size_t size, uint32_t magic, uint32_t child_count) {
+    if (data == nullptr || size < sizeof(CompactTreeHeader)) {
+        return false;
+    }
+
+    const CompactTreeHeader& header = *static_cast<const CompactTreeHeader*>(data);
+
+    if (header.magic != magic || header.version != COMPACT_TREE_VERSION || header.node_count == 0) {
+        return false;
+    }
+
+    if (header.node_offset % COMPACT_TREE_ALIGNMENT != 0 || header.primitive_offset % COMPACT_TREE_ALIGNMENT != 0) {
+        return false;
+    }
+
+    if (header.node_offset < sizeof(CompactTreeHeader) ||
+        header.node_offset + static_cast<size_t>(header.node_count) * sizeof(CompactTreeNode) > header.primitive_offset ||
+        get_compact_tree_size(header) > size)
+    {
+        return false;
+    }
+
+    const CompactTreeNode* nodes = reinterpret_cast<const CompactTreeNode*>(static_cast<const char*>(data) + header.node_offset);
+
+    for (uint32_t i = 0; i < header.node_count; i++) {
+        const CompactTreeNode& node = nodes[i];
+
+        uint64_t last_primitive = static_cast<uint64_t>(node.first_primitive) + node.primitive_count;
+        if (last_primitive > header.primitive_count) {
+            return false;
+        }
+
+        if (node.child_mask >> child_count != 0) {
+            return false;
+        }
+
+        if (node.child_mask != 0) {
+            uint64_t last_child = static_cast<uint64_t>(node.first_child) + std::bitset<8>(node.child_mask).count();
+            if (node.first_child <= i || last_child > header.node_count) {
+                return false;
+            }
+
+            for (uint64_t child = node.first_child; child < last_child; child++) {
+                if (nodes[child].first_primitive < last_primitive) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+inline bool save_compact_tree(const char* path, const void* data, size_t size) {
+    std::FILE* file = std::fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    bool result = std::fwrite(data, 1, size, file) == size;
+    return std::fclose(file) == 0 && result;
+}
@@ -1,22 +1,83 @@
 #pragma once
 
+#include "memory_resource.h"
+
+#include <algorithm>
 #include <cassert>
-#include <cstdlib>
+#include <cstddef>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Allocations are counted by size class, class `i` holds sizes greater than `2^(i-1)` up to `2^i`.
+constexpr size_t MEMORY_SIZE_CLASS_COUNT = 32;
+
+inline size_t get_memory_size_class(size_t size) {
+    if (size <= 1) {
+        return 0;
+    }
 
+    // One plus the index of the highest set bit of `size - 1`.
+    unsigned long long value = size - 1;
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    size_t size_class = index + 1;
+#else
+    size_t size_class = 64 - __builtin_clzll(value);
+#endif
+
+    return std::min(size_class, MEMORY_SIZE_CLASS_COUNT - 1);
+}
+
+// Counts memory allocated by an acceleration structure from a backing memory resource. Footprint is what the
+// allocations actually take from the backing resource, including its rounding and bookkeeping.
 class CountMemoryResource {
 public:
+    CountMemoryResource(MemoryResource& upstream_ = get_malloc_memory_resource())
+        : upstream(upstream_)
+    {
+    }
+
     void* allocate(size_t size) {
+        size_t memory_footprint;
+        void* memory = upstream.allocate_measured(size, memory_footprint);
+
         allocated += size;
-        return std::malloc(size);
+        peak_allocated = std::max(peak_allocated, allocated);
+
+        footprint += memory_footprint;
+        peak_footprint = std::max(peak_footprint, footprint);
+
+        allocation_count++;
+        size_classes[get_memory_size_class(size)]++;
+
+        return memory;
     }
 
     void deallocate(void* memory, size_t size) {
         assert(allocated >= size);
         allocated -= size;
-        return std::free(memory);
+
+        size_t memory_footprint;
+        upstream.deallocate_measured(memory, size, memory_footprint);
+
+        assert(footprint >= memory_footprint);
+        footprint -= memory_footprint;
+
+        deallocation_count++;
     }
 
+    MemoryResource& upstream;
+
     size_t allocated = 0;
+    size_t peak_allocated = 0;
+    size_t footprint = 0;
+    size_t peak_footprint = 0;
+    size_t allocation_count = 0;
+    size_t deallocation_count = 0;
+    size_t size_classes[MEMORY_SIZE_CLASS_COUNT] = {};
 };
 
 template <typename T>
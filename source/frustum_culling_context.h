@@ -0,0 +1,257 @@
+#pragma once
+
+#include "maths.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class AccelerationStructurePrimitive;
+
+constexpr uint8_t FRUSTUM_CULLING_UNKNOWN = 0;
+constexpr uint8_t FRUSTUM_CULLING_OUTSIDE = 1;
+constexpr uint8_t FRUSTUM_CULLING_INSIDE = 2;
+constexpr uint8_t FRUSTUM_CULLING_PARTIAL = 3;
+
+// Classification is only reused when the frustum delta is smaller than the margin by this much (relative to the scale of
+// the values involved), so floating point error can't flip it.
+constexpr float FRUSTUM_CULLING_TOLERANCE = 1e-4f;
+
+struct FrustumCullingNotification {
+    AccelerationStructurePrimitive* primitive;
+    bool is_removed;
+};
+
+// Classification of a node against the frustum of the query that last visited it.
+struct FrustumCullingNodeState {
+    uint32_t frame = 0;
+    uint8_t classification = FRUSTUM_CULLING_UNKNOWN;
+
+    // The plane an outside node is behind.
+    uint8_t plane = 0;
+
+    // How far an outside node is behind its plane, or how far an inside node is in front of all planes.
+    float margin = 0.f;
+};
+
+// Remembers the visible set of the previous frustum query, so the next query reports only primitives that were added to
+// or removed from it. Acceleration structures may also remember which nodes were fully inside or fully outside of the
+// previous frustum and skip those that couldn't have changed.
+class FrustumCullingContext {
+public:
+    // Must be called for primitives that were added to or updated in the acceleration structure since the last query.
+    void notify_moved(AccelerationStructurePrimitive& primitive) {
+        m_notifications.push_back(FrustumCullingNotification{ &primitive, false });
+    }
+
+    // Must be called for primitives that were removed from the acceleration structure since the last query. The
+    // primitive is not accessed, so it may be destroyed already.
+    void notify_removed(AccelerationStructurePrimitive& primitive) {
+        m_notifications.push_back(FrustumCullingNotification{ &primitive, true });
+        m_has_removed = true;
+    }
+
+    void reset() {
+        m_nodes.clear();
+        m_visible.clear();
+        m_notifications.clear();
+        m_has_removed = false;
+        m_structure = nullptr;
+        m_has_frustum = false;
+    }
+
+    const std::unordered_set<AccelerationStructurePrimitive*>& get_visible() const {
+        return m_visible;
+    }
+
+private:
+    // Node states are only valid for the same structure and the same structure version, since nodes may be deleted.
+    void begin(const void* structure, uint32_t version, const frustum& frustum) {
+        if (!m_has_frustum || m_structure != structure || m_version != version) {
+            m_nodes.clear();
+        }
+
+        m_structure = structure;
+        m_version = version;
+        m_frame++;
+
+        if (m_has_frustum) {
+            for (size_t i = 0; i < 6; i++) {
+                m_normal_deltas[i] = float3{
+                    std::abs(frustum.data[i].normal.x - m_frustum.data[i].normal.x),
+                    std::abs(frustum.data[i].normal.y - m_frustum.data[i].normal.y),
+                    std::abs(frustum.data[i].normal.z - m_frustum.data[i].normal.z)
+                };
+                m_distance_deltas[i] = std::abs(frustum.data[i].distance - m_frustum.data[i].distance);
+            }
+        }
+    }
+
+    void end(const frustum& frustum) {
+        m_frustum = frustum;
+        m_has_frustum = true;
+        m_notifications.clear();
+        m_has_removed = false;
+    }
+
+    // Brings moved and removed primitives up to date, so nodes can be skipped without looking at them.
+    template <typename Predicate>
+    void apply_notifications(Predicate is_visible, std::vector<AccelerationStructurePrimitive*>& added, std::vector<AccelerationStructurePrimitive*>& removed) {
+        if (!m_has_removed) {
+            // Primitives notified more than once are simply updated more than once.
+            for (const FrustumCullingNotification& notification : m_notifications) {
+                update_visibility(notification.primitive, is_visible(*notification.primitive), added, removed);
+            }
+        } else {
+            // Only the last notification of each primitive matters, and a removed primitive may be destroyed already.
+            std::unordered_set<AccelerationStructurePrimitive*> handled;
+
+            for (auto it = m_notifications.rbegin(); it != m_notifications.rend(); ++it) {
+                if (handled.insert(it->primitive).second) {
+                    if (it->is_removed) {
+                        if (m_visible.erase(it->primitive) != 0) {
+                            removed.push_back(it->primitive);
+                        }
+                    } else {
+                        update_visibility(it->primitive, is_visible(*it->primitive), added, removed);
+                    }
+                }
+            }
+        }
+    }
+
+    // Used by acceleration structures that can't reuse node classification.
+    void apply(const std::vector<AccelerationStructurePrimitive*>& visible, std::vector<AccelerationStructurePrimitive*>& added, std::vector<AccelerationStructurePrimitive*>& removed) {
+        std::unordered_set<AccelerationStructurePrimitive*> new_visible(visible.begin(), visible.end());
+
+        for (AccelerationStructurePrimitive* primitive : m_visible) {
+            if (new_visible.count(primitive) == 0) {
+                removed.push_back(primitive);
+            }
+        }
+
+        for (AccelerationStructurePrimitive* primitive : new_visible) {
+            if (m_visible.count(primitive) == 0) {
+                added.push_back(primitive);
+            }
+        }
+
+        m_visible.swap(new_visible);
+        m_nodes.clear();
+        m_notifications.clear();
+        m_has_removed = false;
+    }
+
+    void update_visibility(AccelerationStructurePrimitive* primitive, bool is_visible, std::vector<AccelerationStructurePrimitive*>& added, std::vector<AccelerationStructurePrimitive*>& removed) {
+        if (is_visible) {
+            if (m_visible.insert(primitive).second) {
+                added.push_back(primitive);
+            }
+        } else {
+            if (m_visible.erase(primitive) != 0) {
+                removed.push_back(primitive);
+            }
+        }
+    }
+
+    FrustumCullingNodeState& get_node_state(const void* node) {
+        return m_nodes[node];
+    }
+
+    // Whether the state was written by the previous query.
+    bool is_valid(const FrustumCullingNodeState& state) const {
+        return state.classification != FRUSTUM_CULLING_UNKNOWN && state.frame + 1 == m_frame;
+    }
+
+    // Whether an inside or outside node is guaranteed to keep its classification. If so, the state is carried over to
+    // the current frustum with a smaller margin.
+    bool is_unchanged(const aabbox3& bounds, FrustumCullingNodeState& state) const {
+        float3 reach = get_reach(bounds);
+
+        // No point of the node moved relative to the plane further than this.
+        float delta = 0.f;
+
+        if (state.classification == FRUSTUM_CULLING_OUTSIDE) {
+            delta = dot(m_normal_deltas[state.plane], reach) + m_distance_deltas[state.plane];
+        } else {
+            for (size_t i = 0; i < 6; i++) {
+                delta = std::max(delta, dot(m_normal_deltas[i], reach) + m_distance_deltas[i]);
+            }
+        }
+
+        if (delta + get_tolerance(reach, m_frustum) < state.margin) {
+            state.frame = m_frame;
+            state.margin -= delta;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Must match `intersect(const aabbox3&, const frustum&)` for outside nodes.
+    void classify(const aabbox3& bounds, const frustum& frustum, FrustumCullingNodeState& state) const {
+        float inside_margin = FLT_MAX;
+
+        for (size_t i = 0; i < 6; i++) {
+            const plane& plane = frustum.data[i];
+
+            float3 abs_normal{ std::abs(plane.normal.x), std::abs(plane.normal.y), std::abs(plane.normal.z) };
+            float distance = dot(bounds.center, plane.normal) + plane.distance;
+            float radius = dot(bounds.extent, abs_normal);
+
+            if (distance + radius < 0.f) {
+                state.frame = m_frame;
+                state.classification = FRUSTUM_CULLING_OUTSIDE;
+                state.plane = static_cast<uint8_t>(i);
+                state.margin = -(distance + radius);
+                return;
+            }
+
+            inside_margin = std::min(inside_margin, distance - radius);
+        }
+
+        // Primitives of an inside node must pass the primitive test, so nodes touching a plane are partial.
+        state.frame = m_frame;
+        state.classification = inside_margin > get_tolerance(get_reach(bounds), frustum) ? FRUSTUM_CULLING_INSIDE : FRUSTUM_CULLING_PARTIAL;
+        state.plane = 0;
+        state.margin = inside_margin;
+    }
+
+    // Upper bound of the absolute coordinates of the box.
+    static float3 get_reach(const aabbox3& bounds) {
+        return float3{
+            std::abs(bounds.center.x) + bounds.extent.x,
+            std::abs(bounds.center.y) + bounds.extent.y,
+            std::abs(bounds.center.z) + bounds.extent.z
+        };
+    }
+
+    static float get_tolerance(const float3& reach, const frustum& frustum) {
+        float distance = 0.f;
+        for (const plane& plane : frustum.data) {
+            distance = std::max(distance, std::abs(plane.distance));
+        }
+        return FRUSTUM_CULLING_TOLERANCE * (1.f + reach.x + reach.y + reach.z + distance);
+    }
+
+    std::unordered_map<const void*, FrustumCullingNodeState> m_nodes;
+    std::unordered_set<AccelerationStructurePrimitive*> m_visible;
+    std::vector<FrustumCullingNotification> m_notifications;
+    bool m_has_removed = false;
+
+    const void* m_structure = nullptr;
+    uint32_t m_version = 0;
+    uint32_t m_frame = 0;
+
+    frustum m_frustum;
+    bool m_has_frustum = false;
+    float3 m_normal_deltas[6];
+    float m_distance_deltas[6];
+
+    friend class AccelerationStructure;
+    friend class OctreeAccelerationStructure;
+};
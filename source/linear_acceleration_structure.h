@@ -30,6 +30,8 @@ public:
         // No-op.
     }
 
+    using AccelerationStructure::query;
+
     void query(const aabbox3& aabbox, std::vector<AccelerationStructurePrimitive*>& output) const override {
         for (AccelerationStructurePrimitive* primitive : m_primitives) {
             if (intersect(primitive->get_bounds(), aabbox)) {
@@ -46,6 +48,26 @@ public:
         }
     }
 
+    // Each primitive is loaded once for all queries.
+    void query(const aabbox3* aabboxes, size_t count, std::vector<AccelerationStructurePrimitive*>* outputs) const override {
+        collect_primitives(aabboxes, count, outputs);
+    }
+
+    void query(const frustum* frustums, size_t count, std::vector<AccelerationStructurePrimitive*>* outputs) const override {
+        collect_primitives(frustums, count, outputs);
+    }
+
 private:
+    template <typename Bounds>
+    void collect_primitives(const Bounds* bounds, size_t count, std::vector<AccelerationStructurePrimitive*>* outputs) const {
+        for (AccelerationStructurePrimitive* primitive : m_primitives) {
+            for (size_t i = 0; i < count; i++) {
+                if (intersect(primitive->get_bounds(), bounds[i])) {
+                    outputs[i].push_back(primitive);
+                }
+            }
+        }
+    }
+
     std::vector<AccelerationStructurePrimitive*, CountAllocator<AccelerationStructurePrimitive*>> m_primitives;
 };
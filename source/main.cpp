@@ -1,12 +1,63 @@
+#include "async_query_queue.h"
+#include "compact_octree.h"
+#include "compact_quadtree.h"
 #include "linear_acceleration_structure.h"
+#include "mapped_file.h"
+#include "memory_resource.h"
 #include "octree_acceleration_structure.h"
 #include "quadtree_acceleration_structure.h"
+#include "static_dynamic_acceleration_structure.h"
+#include "sweep_and_prune_acceleration_structure.h"
 
 #include <chrono>
+#include <cstdio>
 #include <iostream>
+#include <memory>
 #include <random>
+#include <thread>
+#include <unordered_set>
 
 constexpr uint32_t MAX_DEPTH = 5;
+constexpr uint32_t ADAPTIVE_MAX_DEPTH = 16;
+constexpr uint32_t ADAPTIVE_SPLIT_THRESHOLD = 32;
+constexpr uint32_t ADAPTIVE_MERGE_THRESHOLD = 8;
+constexpr uint32_t MAX_GROWTH = 4;
+constexpr size_t DRIFT_PRIMITIVES = 65536;
+constexpr size_t DRIFT_STEPS = 10;
+constexpr float DRIFT_ELAPSED_TIME = 5.f;
+constexpr size_t COHERENCE_PRIMITIVES = 65536;
+constexpr size_t COHERENCE_FRAMES = 300;
+constexpr size_t COHERENCE_MOVING_PRIMITIVES = COHERENCE_PRIMITIVES / 100;
+constexpr float COHERENCE_CAMERA_SPEED = 2.f;
+constexpr float COHERENCE_CAMERA_TURN = 0.005f;
+constexpr size_t OCCLUSION_PRIMITIVES = 65536;
+constexpr size_t OCCLUSION_BLOCKS = 16;
+constexpr size_t OCCLUSION_VIEWS = 100;
+constexpr uint32_t OCCLUSION_WIDTH = 256;
+constexpr uint32_t OCCLUSION_HEIGHT = 128;
+constexpr size_t SCREEN_SIZE_PRIMITIVES = 65536;
+constexpr size_t SCREEN_SIZE_VIEWS = 100;
+constexpr float SCREEN_SIZE_FOV = 1.2f;
+constexpr float SCREEN_SIZE_HEIGHT = 1080.f;
+constexpr float SCREEN_SIZE_MIN_SIZE = 4.f;
+constexpr size_t STATIC_DYNAMIC_PRIMITIVES = 524288;
+constexpr size_t STATIC_DYNAMIC_STRIDE = 20;
+constexpr size_t STATIC_DYNAMIC_FRAMES = 10;
+constexpr size_t ASYNC_PRIMITIVES = 65536;
+constexpr size_t BITSET_PRIMITIVES = 524288;
+constexpr size_t BITSET_VIEWS = 100;
+constexpr float BITSET_FOV = 1.2f;
+constexpr size_t MEMORY_PRIMITIVES = 65536;
+constexpr uint32_t STREAMING_TILE_DEPTH = 3;
+constexpr size_t STREAMING_TILES = 16;
+constexpr size_t STREAMING_TILE_PRIMITIVES = 4096;
+constexpr size_t STREAMING_BACKGROUND_PRIMITIVES = 65536;
+constexpr size_t SWEPT_PRIMITIVES = 65536;
+constexpr size_t SWEPT_CLUSTER_PRIMITIVES = 128;
+constexpr float SWEPT_CLUSTER_EXTENT = 4.f;
+constexpr size_t SWEPT_QUERIES = 1000;
+constexpr float SWEPT_ELAPSED_TIME = 0.0167f;
+constexpr const char* LOAD_PATH = "acceleration_structure_benchmark.bin";
 constexpr size_t QUERY_COUNT = 1000;
 constexpr size_t MIN_PRIMITIVES = 32;
 constexpr size_t MAX_PRIMITIVES = 524288;
@@ -20,10 +71,13 @@ static std::uniform_real_distribution<float> query_fov_distribution(1.047f, 2.26
 static std::uniform_real_distribution<float> query_aspect_distribution(0.5f, 1.5f);
 static std::uniform_real_distribution<float> query_near_distribution(0.01f, 0.5f);
 static std::uniform_real_distribution<float> query_far_distribution(5.f, 50.f);
+static std::uniform_real_distribution<float> projectile_extent_distribution(0.05f, 0.2f);
+static std::uniform_real_distribution<float> projectile_speed_distribution(100.f, 1000.f);
 
 class TestPrimitive : public AccelerationStructurePrimitive {
 public:
-    TestPrimitive() {
+    TestPrimitive(uint32_t id = 0) {
+        m_id              = id;
         m_bounds.center.x = center_distribution(generator);
         m_bounds.center.y = center_distribution(generator);
         m_bounds.center.z = center_distribution(generator);
@@ -45,6 +99,32 @@ private:
     float3 m_velocity;
 };
 
+class BoxPrimitive : public AccelerationStructurePrimitive {
+public:
+    BoxPrimitive(uint32_t id, const aabbox3& bounds) {
+        m_id     = id;
+        m_bounds = bounds;
+    }
+};
+
+static void reset_primitives(std::vector<TestPrimitive>& primitives) {
+    generator = std::mt19937();
+
+    for (size_t i = 0; i < primitives.size(); i++) {
+        // Primitives are updated during each test, we want exactly input though (including addresses).
+        primitives[i] = TestPrimitive(static_cast<uint32_t>(i));
+    }
+}
+
+// Compact acceleration structures refer to primitives by id.
+static std::vector<AccelerationStructurePrimitive*> get_primitive_table(std::vector<TestPrimitive>& primitives) {
+    std::vector<AccelerationStructurePrimitive*> result(primitives.size());
+    for (size_t i = 0; i < primitives.size(); i++) {
+        result[primitives[i].get_id()] = &primitives[i];
+    }
+    return result;
+}
+
 static void test_add(AccelerationStructure& acceleration_structure, std::vector<TestPrimitive>& primitives, bool print = true) {
     auto before = std::chrono::high_resolution_clock::now();
 
@@ -59,7 +139,7 @@ static void test_add(AccelerationStructure& acceleration_structure, std::vector<
     }
 }
 
-static void test_update(AccelerationStructure& acceleration_structure, std::vector<TestPrimitive>& primitives) {
+static void test_update(AccelerationStructure& acceleration_structure, std::vector<TestPrimitive>& primitives, bool print = true) {
     for (TestPrimitive& primitive : primitives) {
         primitive.update(0.0167f);
     }
@@ -72,7 +152,9 @@ static void test_update(AccelerationStructure& acceleration_structure, std::vect
 
     auto after = std::chrono::high_resolution_clock::now();
 
-    std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0;
+    if (print) {
+        std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0;
+    }
 }
 
 static aabbox3 aabboxes[QUERY_COUNT];
@@ -81,7 +163,8 @@ static aabbox3 aabboxes[QUERY_COUNT];
 static std::vector<AccelerationStructurePrimitive*> aabbox_model[QUERY_COUNT];
 static std::vector<AccelerationStructurePrimitive*> aabbox_check[QUERY_COUNT];
 
-static void test_query_aabbox(AccelerationStructure& acceleration_structure, size_t n, bool check) {
+template <typename T>
+static void test_query_aabbox(T& acceleration_structure, size_t n, bool check, bool print = true) {
     if (check) {
         for (std::vector<AccelerationStructurePrimitive*>& check : aabbox_check) {
             check.clear();
@@ -100,7 +183,9 @@ static void test_query_aabbox(AccelerationStructure& acceleration_structure, siz
 
     auto after = std::chrono::high_resolution_clock::now();
 
-    std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / QUERY_COUNT;
+    if (print) {
+        std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / QUERY_COUNT;
+    }
 
     if (check) {
         for (size_t i = 0; i < QUERY_COUNT; i++) {
@@ -131,7 +216,8 @@ static frustum frustums[QUERY_COUNT];
 static std::vector<AccelerationStructurePrimitive*> frustum_model[QUERY_COUNT];
 static std::vector<AccelerationStructurePrimitive*> frustum_check[QUERY_COUNT];
 
-static void test_query_frustum(AccelerationStructure& acceleration_structure, size_t n, bool check) {
+template <typename T>
+static void test_query_frustum(T& acceleration_structure, size_t n, bool check, bool print = true) {
     if (check) {
         for (std::vector<AccelerationStructurePrimitive*>& check : frustum_check) {
             check.clear();
@@ -150,7 +236,9 @@ static void test_query_frustum(AccelerationStructure& acceleration_structure, si
 
     auto after = std::chrono::high_resolution_clock::now();
 
-    std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / QUERY_COUNT;
+    if (print) {
+        std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / QUERY_COUNT;
+    }
 
     if (check) {
         for (size_t i = 0; i < QUERY_COUNT; i++) {
@@ -194,12 +282,7 @@ static void test_remove(AccelerationStructure& acceleration_structure, std::vect
 }
 
 static void test(AccelerationStructure& acceleration_structure, std::vector<TestPrimitive>& primitives, bool check) {
-    generator = std::mt19937();
-
-    for (TestPrimitive& primitive : primitives) {
-        // Primitives are updated during each test, we want exactly input though (including addresses).
-        primitive = TestPrimitive();
-    }
+    reset_primitives(primitives);
 
     test_add(acceleration_structure, primitives);
     test_update(acceleration_structure, primitives);
@@ -229,77 +312,1552 @@ static void test_quadtree_acceleration_structure(std::vector<TestPrimitive>& pri
     std::cout << " " << memory_resource.allocated;
 }
 
-int main(int argc, char* argv[]) {
-    for (aabbox3& aabbox : aabboxes) {
-        aabbox.center.x = center_distribution(generator);
-        aabbox.center.y = center_distribution(generator);
-        aabbox.center.z = center_distribution(generator);
-        aabbox.extent.x = query_extent_distribution(generator);
-        aabbox.extent.y = query_extent_distribution(generator);
-        aabbox.extent.z = query_extent_distribution(generator);
+static void test_adaptive_octree_acceleration_structure(std::vector<TestPrimitive>& primitives) {
+    CountMemoryResource memory_resource;
+    OctreeAccelerationStructure acceleration_structure(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, ADAPTIVE_MAX_DEPTH, ADAPTIVE_SPLIT_THRESHOLD, ADAPTIVE_MERGE_THRESHOLD);
+    test(acceleration_structure, primitives, true);
+    std::cout << " " << memory_resource.allocated;
+}
+
+static void test_adaptive_quadtree_acceleration_structure(std::vector<TestPrimitive>& primitives) {
+    CountMemoryResource memory_resource;
+    QuadtreeAccelerationStructure acceleration_structure(memory_resource, float2{}, float2{ 1024.f, 1024.f }, ADAPTIVE_MAX_DEPTH, ADAPTIVE_SPLIT_THRESHOLD, ADAPTIVE_MERGE_THRESHOLD);
+    test(acceleration_structure, primitives, true);
+    std::cout << " " << memory_resource.allocated;
+}
+
+static void test_sweep_and_prune_acceleration_structure(std::vector<TestPrimitive>& primitives) {
+    CountMemoryResource memory_resource;
+    SweepAndPruneAccelerationStructure acceleration_structure(memory_resource);
+    test(acceleration_structure, primitives, true);
+    std::cout << " " << memory_resource.allocated;
+}
+
+// Primitives keep moving for a long time, so most of them leave the initial bounds. Prints AABBox query time after each step.
+static void test_drift(AccelerationStructure& acceleration_structure, std::vector<TestPrimitive>& primitives) {
+    reset_primitives(primitives);
+
+    // Linear acceleration structure doesn't use primitive's node, so both acceleration structures can share primitives.
+    CountMemoryResource memory_resource;
+    LinearAccelerationStructure model(memory_resource);
+
+    test_add(model, primitives, false);
+    test_add(acceleration_structure, primitives, false);
+
+    for (size_t i = 0; i < DRIFT_STEPS; i++) {
+        for (TestPrimitive& primitive : primitives) {
+            primitive.update(DRIFT_ELAPSED_TIME);
+            acceleration_structure.update(primitive);
+        }
+
+        test_query_aabbox(model, primitives.size(), false, false);
+        test_query_aabbox(acceleration_structure, primitives.size(), true);
     }
 
-    for (frustum& frustum : frustums) {
-        float3 source;
-        source.x = center_distribution(generator);
-        source.y = center_distribution(generator);
-        source.z = center_distribution(generator);
+    for (TestPrimitive& primitive : primitives) {
+        acceleration_structure.remove(primitive);
+    }
+}
 
-        float3 target;
-        target.x = center_distribution(generator);
-        target.y = center_distribution(generator);
-        target.z = center_distribution(generator);
+static void test_drift(std::vector<TestPrimitive>& primitives) {
+    {
+        std::cout << "octree";
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure acceleration_structure(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+        test_drift(acceleration_structure, primitives);
+        std::cout << std::endl;
+    }
 
-        float3 up;
-        up.x = 0.f;
-        up.y = 1.f;
-        up.z = 0.f;
+    {
+        std::cout << "growable_octree";
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure acceleration_structure(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH, 0, 0, MAX_GROWTH);
+        test_drift(acceleration_structure, primitives);
+        std::cout << std::endl;
+    }
 
-        float4x4 view = look_at(source, target, up);
+    {
+        std::cout << "quadtree";
+        CountMemoryResource memory_resource;
+        QuadtreeAccelerationStructure acceleration_structure(memory_resource, float2{}, float2{ 1024.f, 1024.f }, MAX_DEPTH);
+        test_drift(acceleration_structure, primitives);
+        std::cout << std::endl;
+    }
 
-        float fov = query_fov_distribution(generator);
-        float aspect = query_aspect_distribution(generator);
-        float z_near = query_near_distribution(generator);
-        float z_far = query_far_distribution(generator);
+    {
+        std::cout << "growable_quadtree";
+        CountMemoryResource memory_resource;
+        QuadtreeAccelerationStructure acceleration_structure(memory_resource, float2{}, float2{ 1024.f, 1024.f }, MAX_DEPTH, 0, 0, MAX_GROWTH);
+        test_drift(acceleration_structure, primitives);
+        std::cout << std::endl;
+    }
+}
 
-        float4x4 projection = perspective(fov, aspect, z_near, z_far);
+static void test_compact_octree(std::vector<TestPrimitive>& primitives) {
+    reset_primitives(primitives);
 
-        float4x4 view_projection = mul(view, projection);
+    std::vector<AccelerationStructurePrimitive*> primitive_table = get_primitive_table(primitives);
 
-        frustum = frustum_from_float4x4(view_projection);
+    CountMemoryResource octree_memory_resource;
+    OctreeAccelerationStructure octree(octree_memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+
+    test_add(octree, primitives, false);
+    test_update(octree, primitives, false);
+
+    CountMemoryResource memory_resource;
+
+    {
+        auto before = std::chrono::high_resolution_clock::now();
+
+        CompactOctree compact_octree(memory_resource, octree);
+
+        auto after = std::chrono::high_resolution_clock::now();
+
+        std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0;
+
+        compact_octree.set_primitives(primitive_table.data());
+
+        test_query_aabbox(compact_octree, primitives.size(), true);
+        test_query_frustum(compact_octree, primitives.size(), true);
+
+        std::cout << " " << memory_resource.allocated;
     }
 
-    for (std::vector<AccelerationStructurePrimitive*>& model : aabbox_model) {
-        model.reserve(MAX_PRIMITIVES);
+    for (TestPrimitive& primitive : primitives) {
+        octree.remove(primitive);
     }
+}
 
-    for (std::vector<AccelerationStructurePrimitive*>& check : aabbox_check) {
-        check.reserve(MAX_PRIMITIVES);
+static void test_compact_quadtree(std::vector<TestPrimitive>& primitives) {
+    reset_primitives(primitives);
+
+    std::vector<AccelerationStructurePrimitive*> primitive_table = get_primitive_table(primitives);
+
+    CountMemoryResource quadtree_memory_resource;
+    QuadtreeAccelerationStructure quadtree(quadtree_memory_resource, float2{}, float2{ 1024.f, 1024.f }, MAX_DEPTH);
+
+    test_add(quadtree, primitives, false);
+    test_update(quadtree, primitives, false);
+
+    CountMemoryResource memory_resource;
+
+    {
+        auto before = std::chrono::high_resolution_clock::now();
+
+        CompactQuadtree compact_quadtree(memory_resource, quadtree);
+
+        auto after = std::chrono::high_resolution_clock::now();
+
+        std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0;
+
+        compact_quadtree.set_primitives(primitive_table.data());
+
+        test_query_aabbox(compact_quadtree, primitives.size(), true);
+        test_query_frustum(compact_quadtree, primitives.size(), true);
+
+        std::cout << " " << memory_resource.allocated;
     }
 
-    for (std::vector<AccelerationStructurePrimitive*>& model : frustum_model) {
-        model.reserve(MAX_PRIMITIVES);
+    for (TestPrimitive& primitive : primitives) {
+        quadtree.remove(primitive);
     }
+}
 
-    for (std::vector<AccelerationStructurePrimitive*>& check : frustum_check) {
-        check.reserve(MAX_PRIMITIVES);
+// Camera flies through the scene while a few primitives move each frame. Prints average time of a full frustum query and
+// of an incremental query per frame, followed by the average number of visibility changes per frame.
+static void test_coherence(AccelerationStructure& acceleration_structure, std::vector<TestPrimitive>& primitives) {
+    reset_primitives(primitives);
+
+    FrustumCullingContext context;
+
+    for (TestPrimitive& primitive : primitives) {
+        acceleration_structure.add(primitive);
+        context.notify_moved(primitive);
     }
 
-    // Perform this test multiple times, use average for statistics.
-    for (size_t i = 0; i < 5; i++) {
-        for (size_t n = MIN_PRIMITIVES; n <= MAX_PRIMITIVES; n *= 2) {
-            std::cout << n;
+    float3 position{ 0.f, 0.f, 0.f };
+    float yaw = 0.f;
 
-            // Primitive addresses must be the same for all acceleration structures.
-            std::vector<TestPrimitive> primitives(n);
+    std::vector<AccelerationStructurePrimitive*> visible;
+    std::vector<AccelerationStructurePrimitive*> added;
+    std::vector<AccelerationStructurePrimitive*> removed;
 
-            test_linear_acceleration_structure(primitives);
-            test_octree_acceleration_structure(primitives);
-            test_quadtree_acceleration_structure(primitives);
+    double full_time = 0.0;
+    double coherent_time = 0.0;
+    size_t changes = 0;
 
-            std::cout << std::endl;
+    for (size_t frame = 0; frame < COHERENCE_FRAMES; frame++) {
+        for (size_t i = 0; i < COHERENCE_MOVING_PRIMITIVES; i++) {
+            TestPrimitive& primitive = primitives[(frame * COHERENCE_MOVING_PRIMITIVES + i) % primitives.size()];
+            primitive.update(0.0167f);
+            acceleration_structure.update(primitive);
+            context.notify_moved(primitive);
+        }
+
+        float3 direction{ std::sin(yaw), 0.f, std::cos(yaw) };
+
+        position.x += direction.x * COHERENCE_CAMERA_SPEED;
+        position.z += direction.z * COHERENCE_CAMERA_SPEED;
+        yaw += COHERENCE_CAMERA_TURN;
+
+        float4x4 view = look_at(position, float3{ position.x + direction.x, position.y, position.z + direction.z }, float3{ 0.f, 1.f, 0.f });
+        float4x4 projection = perspective(1.2f, 1.5f, 0.1f, 1000.f);
+        frustum frustum = frustum_from_float4x4(mul(view, projection));
+
+        visible.clear();
+        added.clear();
+        removed.clear();
+
+        auto before_full = std::chrono::high_resolution_clock::now();
+
+        acceleration_structure.query(frustum, visible);
+
+        auto after_full = std::chrono::high_resolution_clock::now();
+
+        acceleration_structure.query(frustum, context, added, removed);
+
+        auto after_coherent = std::chrono::high_resolution_clock::now();
+
+        full_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after_full - before_full).count() / 1000000.0;
+        coherent_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after_coherent - after_full).count() / 1000000.0;
+        changes += added.size() + removed.size();
+
+        const std::unordered_set<AccelerationStructurePrimitive*>& coherent_visible = context.get_visible();
+
+        if (coherent_visible.size() != visible.size()) {
+            std::cout << "Incremental frustum query sizes don't match." << std::endl;
+            std::abort();
+        }
+
+        for (AccelerationStructurePrimitive* primitive : visible) {
+            if (coherent_visible.count(primitive) == 0) {
+                std::cout << "Incremental frustum query primitives don't match." << std::endl;
+                std::abort();
+            }
+        }
+    }
+
+    std::cout << " " << full_time / COHERENCE_FRAMES << " " << coherent_time / COHERENCE_FRAMES << " " << changes / COHERENCE_FRAMES;
+
+    for (TestPrimitive& primitive : primitives) {
+        acceleration_structure.remove(primitive);
+    }
+}
+
+static void test_coherence(std::vector<TestPrimitive>& primitives) {
+    {
+        std::cout << "coherent_linear";
+        CountMemoryResource memory_resource;
+        LinearAccelerationStructure acceleration_structure(memory_resource);
+        test_coherence(acceleration_structure, primitives);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "coherent_octree";
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure acceleration_structure(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+        test_coherence(acceleration_structure, primitives);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "coherent_adaptive_octree";
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure acceleration_structure(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, ADAPTIVE_MAX_DEPTH, ADAPTIVE_SPLIT_THRESHOLD, ADAPTIVE_MERGE_THRESHOLD);
+        test_coherence(acceleration_structure, primitives);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "coherent_quadtree";
+        CountMemoryResource memory_resource;
+        QuadtreeAccelerationStructure acceleration_structure(memory_resource, float2{}, float2{ 1024.f, 1024.f }, MAX_DEPTH);
+        test_coherence(acceleration_structure, primitives);
+        std::cout << std::endl;
+    }
+}
+
+// City blocks with a building each, small primitives scattered on the ground, cameras standing in the streets.
+struct OcclusionScene {
+    std::vector<BoxPrimitive> primitives;
+    std::vector<aabbox3> occluders;
+    float4x4 view_projections[OCCLUSION_VIEWS];
+    frustum frustums[OCCLUSION_VIEWS];
+
+    // Written by linear acceleration structure.
+    std::vector<AccelerationStructurePrimitive*> model[OCCLUSION_VIEWS];
+};
+
+static void create_occlusion_scene(OcclusionScene& scene) {
+    std::mt19937 scene_generator;
+
+    constexpr float block_size = 2048.f / OCCLUSION_BLOCKS;
+
+    std::uniform_real_distribution<float> building_extent_distribution(block_size * 0.3f, block_size * 0.45f);
+    std::uniform_real_distribution<float> building_height_distribution(20.f, 150.f);
+
+    for (size_t i = 0; i < OCCLUSION_BLOCKS; i++) {
+        for (size_t j = 0; j < OCCLUSION_BLOCKS; j++) {
+            float height = building_height_distribution(scene_generator);
+            scene.occluders.push_back(aabbox3{
+                float3{ -1024.f + (i + 0.5f) * block_size, height, -1024.f + (j + 0.5f) * block_size },
+                float3{ building_extent_distribution(scene_generator), height, building_extent_distribution(scene_generator) }
+            });
+        }
+    }
+
+    std::uniform_real_distribution<float> position_distribution(-1024.f, 1024.f);
+    std::uniform_real_distribution<float> primitive_extent_distribution(0.5f, 2.f);
+
+    for (size_t i = 0; i < OCCLUSION_PRIMITIVES; i++) {
+        float3 extent{ primitive_extent_distribution(scene_generator), primitive_extent_distribution(scene_generator), primitive_extent_distribution(scene_generator) };
+        scene.primitives.emplace_back(static_cast<uint32_t>(i), aabbox3{ float3{ position_distribution(scene_generator), extent.y, position_distribution(scene_generator) }, extent });
+    }
+
+    std::uniform_int_distribution<int> street_distribution(1, static_cast<int>(OCCLUSION_BLOCKS) - 1);
+    std::uniform_real_distribution<float> height_distribution(2.f, 5.f);
+    std::uniform_real_distribution<float> yaw_distribution(0.f, 6.283f);
+
+    for (size_t i = 0; i < OCCLUSION_VIEWS; i++) {
+        float3 position{ -1024.f + street_distribution(scene_generator) * block_size, height_distribution(scene_generator), position_distribution(scene_generator) };
+
+        float yaw = yaw_distribution(scene_generator);
+
+        float4x4 view = look_at(position, float3{ position.x + std::sin(yaw), position.y, position.z + std::cos(yaw) }, float3{ 0.f, 1.f, 0.f });
+        float4x4 projection = perspective(1.2f, static_cast<float>(OCCLUSION_WIDTH) / OCCLUSION_HEIGHT, 0.1f, 1000.f);
+
+        scene.view_projections[i] = mul(view, projection);
+        scene.frustums[i] = frustum_from_float4x4(scene.view_projections[i]);
+    }
+}
+
+static void render_occluders(const OcclusionScene& scene, size_t view, OcclusionBuffer& occlusion_buffer) {
+    occlusion_buffer.clear(scene.view_projections[view]);
+
+    for (const aabbox3& occluder : scene.occluders) {
+        if (intersect(occluder, scene.frustums[view])) {
+            occlusion_buffer.add_occluder(occluder);
+        }
+    }
+
+    occlusion_buffer.build();
+}
+
+// Prints average time and number of primitives for frustum queries without and with the occlusion buffer.
+static void test_occlusion(AccelerationStructure& acceleration_structure, OcclusionScene& scene, bool check) {
+    for (BoxPrimitive& primitive : scene.primitives) {
+        acceleration_structure.add(primitive);
+    }
+
+    CountMemoryResource memory_resource;
+    OcclusionBuffer occlusion_buffer(memory_resource, OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+
+    std::vector<AccelerationStructurePrimitive*> output;
+
+    double frustum_time = 0.0;
+    double occlusion_time = 0.0;
+    size_t frustum_count = 0;
+    size_t occlusion_count = 0;
+
+    for (size_t i = 0; i < OCCLUSION_VIEWS; i++) {
+        render_occluders(scene, i, occlusion_buffer);
+
+        output.clear();
+
+        auto before_frustum = std::chrono::high_resolution_clock::now();
+
+        acceleration_structure.query(scene.frustums[i], output);
+
+        auto after_frustum = std::chrono::high_resolution_clock::now();
+
+        frustum_count += output.size();
+        output.clear();
+
+        auto before_occlusion = std::chrono::high_resolution_clock::now();
+
+        acceleration_structure.query(scene.frustums[i], occlusion_buffer, output);
+
+        auto after_occlusion = std::chrono::high_resolution_clock::now();
+
+        frustum_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after_frustum - before_frustum).count() / 1000000.0;
+        occlusion_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after_occlusion - before_occlusion).count() / 1000000.0;
+        occlusion_count += output.size();
+
+        std::sort(output.begin(), output.end());
+
+        if (!check) {
+            scene.model[i] = output;
+        } else if (output != scene.model[i]) {
+            std::cout << "Occlusion query primitives don't match." << std::endl;
+            std::abort();
+        }
+    }
+
+    std::cout << " " << frustum_time / OCCLUSION_VIEWS << " " << occlusion_time / OCCLUSION_VIEWS << " " << frustum_count / OCCLUSION_VIEWS << " " << occlusion_count / OCCLUSION_VIEWS;
+
+    for (BoxPrimitive& primitive : scene.primitives) {
+        acceleration_structure.remove(primitive);
+    }
+}
+
+static void test_occlusion() {
+    OcclusionScene scene;
+    create_occlusion_scene(scene);
+
+    {
+        // Occluders are rendered for every query, but only timed here.
+        std::cout << "occlusion_buffer";
+
+        CountMemoryResource memory_resource;
+        OcclusionBuffer occlusion_buffer(memory_resource, OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+
+        auto before = std::chrono::high_resolution_clock::now();
+
+        for (size_t i = 0; i < OCCLUSION_VIEWS; i++) {
+            render_occluders(scene, i, occlusion_buffer);
         }
+
+        auto after = std::chrono::high_resolution_clock::now();
+
+        std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / OCCLUSION_VIEWS << " " << memory_resource.allocated << std::endl;
     }
 
+    {
+        std::cout << "occlusion_linear";
+        CountMemoryResource memory_resource;
+        LinearAccelerationStructure acceleration_structure(memory_resource);
+        test_occlusion(acceleration_structure, scene, false);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "occlusion_octree";
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure acceleration_structure(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+        test_occlusion(acceleration_structure, scene, true);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "occlusion_quadtree";
+        CountMemoryResource memory_resource;
+        QuadtreeAccelerationStructure acceleration_structure(memory_resource, float2{}, float2{ 1024.f, 1024.f }, MAX_DEPTH);
+        test_occlusion(acceleration_structure, scene, true);
+        std::cout << std::endl;
+    }
+}
+
+struct ScreenSizeViews {
+    float3 positions[SCREEN_SIZE_VIEWS];
+    frustum frustums[SCREEN_SIZE_VIEWS];
+
+    // Written by linear acceleration structure, sorted by address.
+    std::vector<AccelerationStructurePrimitive*> model[SCREEN_SIZE_VIEWS];
+};
+
+// Prints average time and number of primitives for frustum queries without and with screen size culling. Checks that
+// the latter are sorted by distance bucket.
+static void test_screen_size(AccelerationStructure& acceleration_structure, std::vector<TestPrimitive>& primitives, ScreenSizeViews& views, bool check) {
+    reset_primitives(primitives);
+
+    for (TestPrimitive& primitive : primitives) {
+        acceleration_structure.add(primitive);
+    }
+
+    float projection_scale = SCREEN_SIZE_HEIGHT / (2.f * std::tan(SCREEN_SIZE_FOV / 2.f));
+
+    std::vector<AccelerationStructurePrimitive*> output;
+
+    double frustum_time = 0.0;
+    double screen_size_time = 0.0;
+    size_t frustum_count = 0;
+    size_t screen_size_count = 0;
+
+    for (size_t i = 0; i < SCREEN_SIZE_VIEWS; i++) {
+        output.clear();
+
+        auto before_frustum = std::chrono::high_resolution_clock::now();
+
+        acceleration_structure.query(views.frustums[i], output);
+
+        auto after_frustum = std::chrono::high_resolution_clock::now();
+
+        frustum_count += output.size();
+        output.clear();
+
+        auto before_screen_size = std::chrono::high_resolution_clock::now();
+
+        acceleration_structure.query(views.frustums[i], views.positions[i], projection_scale, SCREEN_SIZE_MIN_SIZE, output);
+
+        auto after_screen_size = std::chrono::high_resolution_clock::now();
+
+        frustum_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after_frustum - before_frustum).count() / 1000000.0;
+        screen_size_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after_screen_size - before_screen_size).count() / 1000000.0;
+        screen_size_count += output.size();
+
+        for (size_t j = 1; j < output.size(); j++) {
+            if (get_distance_bucket(output[j - 1]->get_bounds(), views.positions[i]) > get_distance_bucket(output[j]->get_bounds(), views.positions[i])) {
+                std::cout << "Screen size query primitives aren't sorted." << std::endl;
+                std::abort();
+            }
+        }
+
+        std::sort(output.begin(), output.end());
+
+        if (!check) {
+            views.model[i] = output;
+        } else if (output != views.model[i]) {
+            std::cout << "Screen size query primitives don't match." << std::endl;
+            std::abort();
+        }
+    }
+
+    std::cout << " " << frustum_time / SCREEN_SIZE_VIEWS << " " << screen_size_time / SCREEN_SIZE_VIEWS << " " << frustum_count / SCREEN_SIZE_VIEWS << " " << screen_size_count / SCREEN_SIZE_VIEWS;
+
+    for (TestPrimitive& primitive : primitives) {
+        acceleration_structure.remove(primitive);
+    }
+}
+
+static void test_screen_size(std::vector<TestPrimitive>& primitives) {
+    ScreenSizeViews views;
+
+    for (size_t i = 0; i < SCREEN_SIZE_VIEWS; i++) {
+        float3 target{ center_distribution(generator), center_distribution(generator), center_distribution(generator) };
+        views.positions[i] = float3{ center_distribution(generator), center_distribution(generator), center_distribution(generator) };
+
+        float4x4 view = look_at(views.positions[i], target, float3{ 0.f, 1.f, 0.f });
+        float4x4 projection = perspective(SCREEN_SIZE_FOV, 16.f / 9.f, 0.1f, 2000.f);
+
+        views.frustums[i] = frustum_from_float4x4(mul(view, projection));
+    }
+
+    {
+        std::cout << "screen_size_linear";
+        CountMemoryResource memory_resource;
+        LinearAccelerationStructure acceleration_structure(memory_resource);
+        test_screen_size(acceleration_structure, primitives, views, false);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "screen_size_octree";
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure acceleration_structure(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+        test_screen_size(acceleration_structure, primitives, views, true);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "screen_size_quadtree";
+        CountMemoryResource memory_resource;
+        QuadtreeAccelerationStructure acceleration_structure(memory_resource, float2{}, float2{ 1024.f, 1024.f }, MAX_DEPTH);
+        test_screen_size(acceleration_structure, primitives, views, true);
+        std::cout << std::endl;
+    }
+}
+
+// Every STATIC_DYNAMIC_STRIDE-th primitive moves, the rest never do.
+static bool is_dynamic(size_t index) {
+    return index % STATIC_DYNAMIC_STRIDE == 0;
+}
+
+// Prints time to add all primitives, average time to update the moving ones, and query times.
+template <typename Add>
+static void test_static_dynamic(AccelerationStructure& acceleration_structure, std::vector<TestPrimitive>& primitives, Add add) {
+    reset_primitives(primitives);
+
+    // Linear acceleration structure doesn't use primitive's node, so both acceleration structures can share primitives.
+    CountMemoryResource model_memory_resource;
+    LinearAccelerationStructure model(model_memory_resource);
+
+    test_add(model, primitives, false);
+
+    auto before = std::chrono::high_resolution_clock::now();
+
+    add(primitives);
+
+    auto after = std::chrono::high_resolution_clock::now();
+
+    std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0;
+
+    double update_time = 0.0;
+
+    for (size_t i = 0; i < STATIC_DYNAMIC_FRAMES; i++) {
+        for (size_t j = 0; j < primitives.size(); j += STATIC_DYNAMIC_STRIDE) {
+            primitives[j].update(0.0167f);
+        }
+
+        before = std::chrono::high_resolution_clock::now();
+
+        for (size_t j = 0; j < primitives.size(); j += STATIC_DYNAMIC_STRIDE) {
+            acceleration_structure.update(primitives[j]);
+        }
+
+        after = std::chrono::high_resolution_clock::now();
+
+        update_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0;
+    }
+
+    std::cout << " " << update_time / STATIC_DYNAMIC_FRAMES;
+
+    test_query_aabbox(model, primitives.size(), false, false);
+    test_query_frustum(model, primitives.size(), false, false);
+
+    test_query_aabbox(acceleration_structure, primitives.size(), true);
+    test_query_frustum(acceleration_structure, primitives.size(), true);
+
+    for (TestPrimitive& primitive : primitives) {
+        acceleration_structure.remove(primitive);
+    }
+}
+
+static void test_static_dynamic(std::vector<TestPrimitive>& primitives) {
+    {
+        std::cout << "static_dynamic_octree";
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure acceleration_structure(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+        test_static_dynamic(acceleration_structure, primitives, [&](std::vector<TestPrimitive>& primitives) {
+            for (TestPrimitive& primitive : primitives) {
+                acceleration_structure.add(primitive);
+            }
+        });
+        std::cout << " " << memory_resource.allocated << std::endl;
+    }
+
+    {
+        std::cout << "static_dynamic_bvh_octree";
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure dynamic(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+        StaticDynamicAccelerationStructure acceleration_structure(memory_resource, dynamic);
+        test_static_dynamic(acceleration_structure, primitives, [&](std::vector<TestPrimitive>& primitives) {
+            for (size_t i = 0; i < primitives.size(); i++) {
+                if (is_dynamic(i)) {
+                    acceleration_structure.add(primitives[i]);
+                } else {
+                    acceleration_structure.add_static(primitives[i]);
+                }
+            }
+            acceleration_structure.build();
+        });
+        std::cout << " " << memory_resource.allocated << std::endl;
+    }
+}
+
+static void check_outputs(const std::vector<AccelerationStructurePrimitive*>* outputs, const std::vector<AccelerationStructurePrimitive*>* models) {
+    for (size_t i = 0; i < QUERY_COUNT; i++) {
+        std::vector<AccelerationStructurePrimitive*> sorted = outputs[i];
+        std::sort(sorted.begin(), sorted.end());
+
+        if (sorted != models[i]) {
+            std::cout << "Batch query primitives don't match." << std::endl;
+            std::abort();
+        }
+    }
+}
+
+// Prints average time per query of batch AABBox and frustum queries, then of the same batches executed asynchronously,
+// and how long the caller is blocked in submit.
+static void test_async(AccelerationStructure& acceleration_structure, std::vector<TestPrimitive>& primitives, AsyncQueryQueue& queue) {
+    reset_primitives(primitives);
+
+    CountMemoryResource model_memory_resource;
+    LinearAccelerationStructure model(model_memory_resource);
+
+    test_add(model, primitives, false);
+    test_query_aabbox(model, primitives.size(), false, false);
+    test_query_frustum(model, primitives.size(), false, false);
+
+    test_add(acceleration_structure, primitives, false);
+
+    {
+        std::vector<std::vector<AccelerationStructurePrimitive*>> outputs(QUERY_COUNT);
+
+        auto before = std::chrono::high_resolution_clock::now();
+
+        acceleration_structure.query(aabboxes, QUERY_COUNT, outputs.data());
+
+        auto after = std::chrono::high_resolution_clock::now();
+
+        std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / QUERY_COUNT;
+
+        check_outputs(outputs.data(), aabbox_model);
+    }
+
+    {
+        std::vector<std::vector<AccelerationStructurePrimitive*>> outputs(QUERY_COUNT);
+
+        auto before = std::chrono::high_resolution_clock::now();
+
+        acceleration_structure.query(frustums, QUERY_COUNT, outputs.data());
+
+        auto after = std::chrono::high_resolution_clock::now();
+
+        std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / QUERY_COUNT;
+
+        check_outputs(outputs.data(), frustum_model);
+    }
+
+    {
+        auto before = std::chrono::high_resolution_clock::now();
+
+        std::future<AsyncQueryResult> aabbox_result = queue.submit(acceleration_structure, std::vector<aabbox3>(std::begin(aabboxes), std::end(aabboxes)));
+        std::future<AsyncQueryResult> frustum_result = queue.submit(acceleration_structure, std::vector<frustum>(std::begin(frustums), std::end(frustums)));
+
+        auto submitted = std::chrono::high_resolution_clock::now();
+
+        AsyncQueryResult aabbox_outputs = aabbox_result.get();
+        AsyncQueryResult frustum_outputs = frustum_result.get();
+
+        auto after = std::chrono::high_resolution_clock::now();
+
+        std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / (QUERY_COUNT * 2);
+        std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(submitted - before).count() / 1000000.0;
+
+        check_outputs(aabbox_outputs.data(), aabbox_model);
+        check_outputs(frustum_outputs.data(), frustum_model);
+    }
+
+    for (TestPrimitive& primitive : primitives) {
+        acceleration_structure.remove(primitive);
+    }
+}
+
+static void test_async(std::vector<TestPrimitive>& primitives) {
+    AsyncQueryQueue queue(std::max(std::thread::hardware_concurrency(), 1u));
+
+    {
+        std::cout << "async_linear";
+        CountMemoryResource memory_resource;
+        LinearAccelerationStructure acceleration_structure(memory_resource);
+        test_async(acceleration_structure, primitives, queue);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "async_octree";
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure acceleration_structure(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+        test_async(acceleration_structure, primitives, queue);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "async_quadtree";
+        CountMemoryResource memory_resource;
+        QuadtreeAccelerationStructure acceleration_structure(memory_resource, float2{}, float2{ 1024.f, 1024.f }, MAX_DEPTH);
+        test_async(acceleration_structure, primitives, queue);
+        std::cout << std::endl;
+    }
+}
+
+struct BitsetViews {
+    frustum frustums[BITSET_VIEWS];
+
+    // Sorted ids of primitives visible from each view, written by the linear acceleration structure.
+    std::vector<uint32_t> models[BITSET_VIEWS];
+};
+
+// Prints average time per view of a pointer query followed by sorting its output, of an id query and of a bitset query,
+// then average time to find primitives that stopped being visible between two views and the number of visible primitives.
+template <typename T>
+static void test_bitset(const T& acceleration_structure, size_t n, BitsetViews& views, bool check) {
+    double pointer_time = 0.0;
+    double id_time = 0.0;
+    double bitset_time = 0.0;
+    double subtract_time = 0.0;
+    size_t visible_count = 0;
+
+    std::vector<AccelerationStructurePrimitive*> pointers;
+    std::vector<uint32_t> ids;
+    PrimitiveBitset bitsets[2];
+    bitsets[0].resize(n);
+    bitsets[1].resize(n);
+
+    for (size_t i = 0; i < BITSET_VIEWS; i++) {
+        pointers.clear();
+        ids.clear();
+
+        PrimitiveBitset& bitset = bitsets[i % 2];
+        PrimitiveBitset& previous_bitset = bitsets[(i + 1) % 2];
+
+        auto before = std::chrono::high_resolution_clock::now();
+
+        acceleration_structure.query(views.frustums[i], pointers);
+        std::sort(pointers.begin(), pointers.end());
+
+        auto after = std::chrono::high_resolution_clock::now();
+
+        pointer_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0;
+
+        before = std::chrono::high_resolution_clock::now();
+
+        acceleration_structure.query(views.frustums[i], ids);
+
+        after = std::chrono::high_resolution_clock::now();
+
+        id_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0;
+
+        before = std::chrono::high_resolution_clock::now();
+
+        bitset.clear();
+        acceleration_structure.query(views.frustums[i], bitset);
+
+        after = std::chrono::high_resolution_clock::now();
+
+        bitset_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0;
+
+        if (i > 0) {
+            PrimitiveBitset removed = previous_bitset;
+
+            before = std::chrono::high_resolution_clock::now();
+
+            removed.subtract(bitset);
+
+            after = std::chrono::high_resolution_clock::now();
+
+            subtract_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0;
+        }
+
+        visible_count += ids.size();
+
+        std::sort(ids.begin(), ids.end());
+
+        if (check) {
+            std::vector<uint32_t> bitset_ids;
+            bitset.get_ids(bitset_ids);
+
+            if (ids != views.models[i] || bitset_ids != views.models[i]) {
+                std::cout << "Bitset query primitives don't match." << std::endl;
+                std::abort();
+            }
+        } else {
+            views.models[i] = ids;
+        }
+    }
+
+    std::cout << " " << pointer_time / BITSET_VIEWS << " " << id_time / BITSET_VIEWS << " " << bitset_time / BITSET_VIEWS << " " << subtract_time / (BITSET_VIEWS - 1) << " " << visible_count / BITSET_VIEWS;
+}
+
+static void test_bitset(std::vector<TestPrimitive>& primitives) {
+    reset_primitives(primitives);
+
+    std::vector<AccelerationStructurePrimitive*> primitive_table = get_primitive_table(primitives);
+
+    BitsetViews views;
+
+    for (frustum& frustum : views.frustums) {
+        float3 position{ center_distribution(generator), center_distribution(generator), center_distribution(generator) };
+        float3 target{ center_distribution(generator), center_distribution(generator), center_distribution(generator) };
+
+        float4x4 view = look_at(position, target, float3{ 0.f, 1.f, 0.f });
+        float4x4 projection = perspective(BITSET_FOV, 16.f / 9.f, 0.1f, 2000.f);
+
+        frustum = frustum_from_float4x4(mul(view, projection));
+    }
+
+    CountMemoryResource memory_resource;
+
+    LinearAccelerationStructure linear(memory_resource);
+    OctreeAccelerationStructure octree(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+    QuadtreeAccelerationStructure quadtree(memory_resource, float2{}, float2{ 1024.f, 1024.f }, MAX_DEPTH);
+
+    test_add(linear, primitives, false);
+    test_add(octree, primitives, false);
+
+    std::cout << "bitset_linear";
+    test_bitset(linear, primitives.size(), views, false);
+    std::cout << std::endl;
+
+    std::cout << "bitset_octree";
+    test_bitset(octree, primitives.size(), views, true);
+    std::cout << std::endl;
+
+    {
+        CompactOctree compact_octree(memory_resource, octree);
+        compact_octree.set_primitives(primitive_table.data());
+
+        std::cout << "bitset_compact_octree";
+        test_bitset(compact_octree, primitives.size(), views, true);
+        std::cout << std::endl;
+    }
+
+    for (TestPrimitive& primitive : primitives) {
+        octree.remove(primitive);
+    }
+
+    // Quadtree can't share primitives with octree.
+    test_add(quadtree, primitives, false);
+
+    std::cout << "bitset_quadtree";
+    test_bitset(quadtree, primitives.size(), views, true);
+    std::cout << std::endl;
+
+    {
+        CompactQuadtree compact_quadtree(memory_resource, quadtree);
+        compact_quadtree.set_primitives(primitive_table.data());
+
+        std::cout << "bitset_compact_quadtree";
+        test_bitset(compact_quadtree, primitives.size(), views, true);
+        std::cout << std::endl;
+    }
+
+    for (TestPrimitive& primitive : primitives) {
+        quadtree.remove(primitive);
+    }
+}
+
+// Prints peak allocated bytes, peak footprint in the backing memory resource, bytes the backing memory resource still
+// holds after all primitives are removed, and numbers of allocations and deallocations.
+template <typename Create>
+static void test_memory(MemoryResource& backing, std::vector<TestPrimitive>& primitives, Create create, const char* name, const char* backing_name, bool print_size_classes = false) {
+    std::cout << "memory_" << name << "_" << backing_name;
+
+    CountMemoryResource memory_resource(backing);
+    std::unique_ptr<AccelerationStructure> acceleration_structure = create(memory_resource);
+
+    test(*acceleration_structure, primitives, true);
+
+    std::cout << " " << memory_resource.peak_allocated << " " << memory_resource.peak_footprint << " " << backing.get_reserved();
+    std::cout << " " << memory_resource.allocation_count << " " << memory_resource.deallocation_count << std::endl;
+
+    if (print_size_classes) {
+        std::cout << "memory_size_classes_" << name;
+        for (size_t count : memory_resource.size_classes) {
+            std::cout << " " << count;
+        }
+        std::cout << std::endl;
+    }
+}
+
+template <typename Create>
+static void test_memory(std::vector<TestPrimitive>& primitives, Create create, const char* name) {
+    {
+        // Allocation sizes don't depend on the backing memory resource, so size classes are printed once.
+        MallocMemoryResource backing;
+        test_memory(backing, primitives, create, name, "malloc", true);
+    }
+
+    {
+        MonotonicMemoryResource backing(get_malloc_memory_resource());
+        test_memory(backing, primitives, create, name, "monotonic");
+    }
+
+    {
+        PoolMemoryResource backing(get_malloc_memory_resource());
+        test_memory(backing, primitives, create, name, "pool");
+    }
+
+    {
+        HugePageMemoryResource huge_page;
+        MonotonicMemoryResource backing(huge_page, HUGE_PAGE_SIZE);
+        test_memory(backing, primitives, create, name, "monotonic_huge_page");
+    }
+
+    {
+        // Only slabs are in huge pages, a huge page per large allocation would waste most of it.
+        HugePageMemoryResource huge_page;
+        MallocMemoryResource large;
+        PoolMemoryResource backing(huge_page, large, HUGE_PAGE_SIZE);
+        test_memory(backing, primitives, create, name, "pool_huge_page");
+    }
+}
+
+static void test_memory(std::vector<TestPrimitive>& primitives) {
+    reset_primitives(primitives);
+
+    // Model must see primitives after the update, like the tested acceleration structures.
+    CountMemoryResource model_memory_resource;
+    LinearAccelerationStructure model(model_memory_resource);
+
+    test_add(model, primitives, false);
+    test_update(model, primitives, false);
+    test_query_aabbox(model, primitives.size(), false, false);
+    test_query_frustum(model, primitives.size(), false, false);
+
+    for (TestPrimitive& primitive : primitives) {
+        model.remove(primitive);
+    }
+
+    test_memory(primitives, [](CountMemoryResource& memory_resource) -> std::unique_ptr<AccelerationStructure> {
+        return std::make_unique<LinearAccelerationStructure>(memory_resource);
+    }, "linear");
+
+    test_memory(primitives, [](CountMemoryResource& memory_resource) -> std::unique_ptr<AccelerationStructure> {
+        return std::make_unique<OctreeAccelerationStructure>(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+    }, "octree");
+
+    test_memory(primitives, [](CountMemoryResource& memory_resource) -> std::unique_ptr<AccelerationStructure> {
+        return std::make_unique<QuadtreeAccelerationStructure>(memory_resource, float2{}, float2{ 1024.f, 1024.f }, MAX_DEPTH);
+    }, "quadtree");
+
+    test_memory(primitives, [](CountMemoryResource& memory_resource) -> std::unique_ptr<AccelerationStructure> {
+        return std::make_unique<OctreeAccelerationStructure>(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, ADAPTIVE_MAX_DEPTH, ADAPTIVE_SPLIT_THRESHOLD, ADAPTIVE_MERGE_THRESHOLD);
+    }, "adaptive_octree");
+
+    test_memory(primitives, [](CountMemoryResource& memory_resource) -> std::unique_ptr<AccelerationStructure> {
+        return std::make_unique<QuadtreeAccelerationStructure>(memory_resource, float2{}, float2{ 1024.f, 1024.f }, ADAPTIVE_MAX_DEPTH, ADAPTIVE_SPLIT_THRESHOLD, ADAPTIVE_MERGE_THRESHOLD);
+    }, "adaptive_quadtree");
+
+    test_memory(primitives, [](CountMemoryResource& memory_resource) -> std::unique_ptr<AccelerationStructure> {
+        return std::make_unique<SweepAndPruneAccelerationStructure>(memory_resource);
+    }, "sweep_and_prune");
+}
+
+struct StreamingScene {
+    // Tiles are 256 meter cubes in distinct columns, their primitives are within them.
+    aabbox3 tiles[STREAMING_TILES];
+    std::vector<BoxPrimitive> tile_primitives[STREAMING_TILES];
+
+    // Primitives that are always in the world. They avoid tile columns, otherwise they'd leave along with the tiles.
+    std::vector<BoxPrimitive> background_primitives;
+};
+
+static void create_streaming_scene(StreamingScene& scene) {
+    std::mt19937 scene_generator;
+
+    constexpr uint32_t tile_count = 1 << STREAMING_TILE_DEPTH;
+    constexpr float tile_size = 2048.f / tile_count;
+
+    std::uniform_int_distribution<uint32_t> tile_distribution(0, tile_count - 1);
+
+    for (size_t i = 0; i < STREAMING_TILES; i++) {
+        aabbox3& tile = scene.tiles[i];
+
+        bool is_taken;
+        do {
+            tile.center = float3{ -1024.f + (tile_distribution(scene_generator) + 0.5f) * tile_size, -1024.f + (tile_distribution(scene_generator) + 0.5f) * tile_size, -1024.f + (tile_distribution(scene_generator) + 0.5f) * tile_size };
+            tile.extent = float3{ tile_size / 2.f, tile_size / 2.f, tile_size / 2.f };
+
+            is_taken = std::any_of(scene.tiles, scene.tiles + i, [&tile](const aabbox3& other) { return other.center.x == tile.center.x && other.center.z == tile.center.z; });
+        } while (is_taken);
+
+        for (size_t j = 0; j < STREAMING_TILE_PRIMITIVES; j++) {
+            float3 extent{ extent_distribution(scene_generator), extent_distribution(scene_generator), extent_distribution(scene_generator) };
+
+            std::uniform_real_distribution<float> x_distribution(tile.center.x - tile.extent.x + extent.x, tile.center.x + tile.extent.x - extent.x);
+            std::uniform_real_distribution<float> y_distribution(tile.center.y - tile.extent.y + extent.y, tile.center.y + tile.extent.y - extent.y);
+            std::uniform_real_distribution<float> z_distribution(tile.center.z - tile.extent.z + extent.z, tile.center.z + tile.extent.z - extent.z);
+
+            uint32_t id = static_cast<uint32_t>(i * STREAMING_TILE_PRIMITIVES + j);
+            scene.tile_primitives[i].emplace_back(id, aabbox3{ float3{ x_distribution(scene_generator), y_distribution(scene_generator), z_distribution(scene_generator) }, extent });
+        }
+    }
+
+    while (scene.background_primitives.size() < STREAMING_BACKGROUND_PRIMITIVES) {
+        aabbox3 bounds{
+            float3{ center_distribution(scene_generator), center_distribution(scene_generator), center_distribution(scene_generator) },
+            float3{ extent_distribution(scene_generator), extent_distribution(scene_generator), extent_distribution(scene_generator) }
+        };
+
+        bool is_in_tile = std::any_of(std::begin(scene.tiles), std::end(scene.tiles), [&bounds](const aabbox3& tile) {
+            return std::abs(bounds.center.x - tile.center.x) < bounds.extent.x + tile.extent.x && std::abs(bounds.center.z - tile.center.z) < bounds.extent.z + tile.extent.z;
+        });
+
+        if (!is_in_tile) {
+            uint32_t id = static_cast<uint32_t>(STREAMING_TILES * STREAMING_TILE_PRIMITIVES + scene.background_primitives.size());
+            scene.background_primitives.emplace_back(id, bounds);
+        }
+    }
+}
+
+// Prints average time per tile to add its primitives one by one and to remove them, then average time per tile to build
+// it separately, to attach it and to detach it.
+template <typename Tree, typename CreateTile>
+static void test_streaming(Tree& world, StreamingScene& scene, CountMemoryResource* tile_memory_resources, CreateTile create_tile) {
+    CountMemoryResource model_memory_resource;
+    LinearAccelerationStructure model(model_memory_resource);
+
+    for (BoxPrimitive& primitive : scene.background_primitives) {
+        model.add(primitive);
+        world.add(primitive);
+    }
+
+    for (std::vector<BoxPrimitive>& tile_primitives : scene.tile_primitives) {
+        for (BoxPrimitive& primitive : tile_primitives) {
+            model.add(primitive);
+        }
+    }
+
+    test_query_aabbox(model, 0, false, false);
+    test_query_frustum(model, 0, false, false);
+
+    auto before = std::chrono::high_resolution_clock::now();
+
+    for (std::vector<BoxPrimitive>& tile_primitives : scene.tile_primitives) {
+        for (BoxPrimitive& primitive : tile_primitives) {
+            world.add(primitive);
+        }
+    }
+
+    auto after = std::chrono::high_resolution_clock::now();
+
+    std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / STREAMING_TILES;
+
+    test_query_aabbox(world, 0, true, false);
+    test_query_frustum(world, 0, true, false);
+
+    before = std::chrono::high_resolution_clock::now();
+
+    for (std::vector<BoxPrimitive>& tile_primitives : scene.tile_primitives) {
+        for (BoxPrimitive& primitive : tile_primitives) {
+            world.remove(primitive);
+        }
+    }
+
+    after = std::chrono::high_resolution_clock::now();
+
+    std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / STREAMING_TILES;
+
+    // In a game tiles would be built on worker threads, each with its own memory resource.
+    std::unique_ptr<Tree> tiles[STREAMING_TILES];
+
+    before = std::chrono::high_resolution_clock::now();
+
+    for (size_t i = 0; i < STREAMING_TILES; i++) {
+        tiles[i] = create_tile(tile_memory_resources[i], scene.tiles[i]);
+
+        for (BoxPrimitive& primitive : scene.tile_primitives[i]) {
+            tiles[i]->add(primitive);
+        }
+    }
+
+    after = std::chrono::high_resolution_clock::now();
+
+    std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / STREAMING_TILES;
+
+    before = std::chrono::high_resolution_clock::now();
+
+    for (std::unique_ptr<Tree>& tile : tiles) {
+        world.attach(*tile);
+    }
+
+    after = std::chrono::high_resolution_clock::now();
+
+    std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / STREAMING_TILES;
+
+    test_query_aabbox(world, 0, true, false);
+    test_query_frustum(world, 0, true, false);
+
+    before = std::chrono::high_resolution_clock::now();
+
+    for (std::unique_ptr<Tree>& tile : tiles) {
+        world.detach(*tile);
+    }
+
+    after = std::chrono::high_resolution_clock::now();
+
+    std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0 / STREAMING_TILES;
+
+    for (BoxPrimitive& primitive : scene.background_primitives) {
+        world.remove(primitive);
+    }
+}
+
+static void test_streaming() {
+    StreamingScene scene;
+    create_streaming_scene(scene);
+
+    {
+        std::cout << "streaming_octree";
+        CountMemoryResource tile_memory_resources[STREAMING_TILES];
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure world(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+        test_streaming(world, scene, tile_memory_resources, [&world](CountMemoryResource& memory_resource, const aabbox3& tile) {
+            aabbox3 bounds = world.get_tile_bounds(tile.center, STREAMING_TILE_DEPTH);
+            return std::make_unique<OctreeAccelerationStructure>(memory_resource, bounds.center, bounds.extent, MAX_DEPTH - STREAMING_TILE_DEPTH);
+        });
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "streaming_quadtree";
+        CountMemoryResource tile_memory_resources[STREAMING_TILES];
+        CountMemoryResource memory_resource;
+        QuadtreeAccelerationStructure world(memory_resource, float2{}, float2{ 1024.f, 1024.f }, MAX_DEPTH);
+        test_streaming(world, scene, tile_memory_resources, [&world](CountMemoryResource& memory_resource, const aabbox3& tile) {
+            aabbox2 bounds = world.get_tile_bounds(float2{ tile.center.x, tile.center.z }, STREAMING_TILE_DEPTH);
+            return std::make_unique<QuadtreeAccelerationStructure>(memory_resource, bounds.center, bounds.extent, MAX_DEPTH - STREAMING_TILE_DEPTH);
+        });
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "streaming_adaptive_octree";
+        CountMemoryResource tile_memory_resources[STREAMING_TILES];
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure world(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, ADAPTIVE_MAX_DEPTH, ADAPTIVE_SPLIT_THRESHOLD, ADAPTIVE_MERGE_THRESHOLD);
+        test_streaming(world, scene, tile_memory_resources, [&world](CountMemoryResource& memory_resource, const aabbox3& tile) {
+            aabbox3 bounds = world.get_tile_bounds(tile.center, STREAMING_TILE_DEPTH);
+            return std::make_unique<OctreeAccelerationStructure>(memory_resource, bounds.center, bounds.extent, ADAPTIVE_MAX_DEPTH - STREAMING_TILE_DEPTH, ADAPTIVE_SPLIT_THRESHOLD, ADAPTIVE_MERGE_THRESHOLD);
+        });
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "streaming_adaptive_quadtree";
+        CountMemoryResource tile_memory_resources[STREAMING_TILES];
+        CountMemoryResource memory_resource;
+        QuadtreeAccelerationStructure world(memory_resource, float2{}, float2{ 1024.f, 1024.f }, ADAPTIVE_MAX_DEPTH, ADAPTIVE_SPLIT_THRESHOLD, ADAPTIVE_MERGE_THRESHOLD);
+        test_streaming(world, scene, tile_memory_resources, [&world](CountMemoryResource& memory_resource, const aabbox3& tile) {
+            aabbox2 bounds = world.get_tile_bounds(float2{ tile.center.x, tile.center.z }, STREAMING_TILE_DEPTH);
+            return std::make_unique<QuadtreeAccelerationStructure>(memory_resource, bounds.center, bounds.extent, ADAPTIVE_MAX_DEPTH - STREAMING_TILE_DEPTH, ADAPTIVE_SPLIT_THRESHOLD, ADAPTIVE_MERGE_THRESHOLD);
+        });
+        std::cout << std::endl;
+    }
+}
+
+// Clusters of small boxes, like debris, and projectiles flying through them.
+struct SweptScene {
+    std::vector<BoxPrimitive> primitives;
+    aabbox3 aabboxes[SWEPT_QUERIES];
+    float3 displacements[SWEPT_QUERIES];
+
+    // Impacts of each query sorted by primitive, written by the linear acceleration structure.
+    std::vector<AccelerationStructureImpact> models[SWEPT_QUERIES];
+};
+
+static void create_swept_scene(SweptScene& scene) {
+    std::mt19937 scene_generator;
+
+    std::uniform_real_distribution<float> position_distribution(-1024.f, 1024.f);
+    std::uniform_real_distribution<float> offset_distribution(-SWEPT_CLUSTER_EXTENT, SWEPT_CLUSTER_EXTENT);
+    std::uniform_real_distribution<float> primitive_extent_distribution(0.1f, 0.5f);
+
+    for (size_t i = 0; i < SWEPT_PRIMITIVES / SWEPT_CLUSTER_PRIMITIVES; i++) {
+        float3 cluster{ position_distribution(scene_generator), position_distribution(scene_generator), position_distribution(scene_generator) };
+
+        for (size_t j = 0; j < SWEPT_CLUSTER_PRIMITIVES; j++) {
+            float3 center{ cluster.x + offset_distribution(scene_generator), cluster.y + offset_distribution(scene_generator), cluster.z + offset_distribution(scene_generator) };
+            float3 extent{ primitive_extent_distribution(scene_generator), primitive_extent_distribution(scene_generator), primitive_extent_distribution(scene_generator) };
+            scene.primitives.emplace_back(static_cast<uint32_t>(scene.primitives.size()), aabbox3{ center, extent });
+        }
+    }
+
+    std::uniform_int_distribution<size_t> target_distribution(0, scene.primitives.size() - 1);
+    std::uniform_real_distribution<float> direction_distribution(-1.f, 1.f);
+    std::uniform_real_distribution<float> progress_distribution(0.f, 1.f);
+
+    // Projectiles are aimed at primitives, so each one passes through at least one of them during the frame, and
+    // usually through a few of its neighbours.
+    for (size_t i = 0; i < SWEPT_QUERIES; i++) {
+        float3 direction = normalize(float3{ direction_distribution(scene_generator), direction_distribution(scene_generator), direction_distribution(scene_generator) });
+        float distance = projectile_speed_distribution(scene_generator) * SWEPT_ELAPSED_TIME;
+        float progress = progress_distribution(scene_generator);
+        float extent = projectile_extent_distribution(scene_generator);
+
+        const aabbox3& target = scene.primitives[target_distribution(scene_generator)].get_bounds();
+
+        scene.displacements[i] = float3{ direction.x * distance, direction.y * distance, direction.z * distance };
+        scene.aabboxes[i] = aabbox3{
+            float3{
+                target.center.x - scene.displacements[i].x * progress,
+                target.center.y - scene.displacements[i].y * progress,
+                target.center.z - scene.displacements[i].z * progress
+            },
+            float3{ extent, extent, extent }
+        };
+    }
+}
+
+// Prints average time per projectile of a swept query and of stepped box queries along the same path (which don't give
+// the time of impact), then the average number of impacts and of steps.
+static void test_swept(AccelerationStructure& acceleration_structure, SweptScene& scene, bool check) {
+    for (BoxPrimitive& primitive : scene.primitives) {
+        acceleration_structure.add(primitive);
+    }
+
+    double swept_time = 0.0;
+    double stepped_time = 0.0;
+    size_t impact_count = 0;
+    size_t step_count = 0;
+
+    std::vector<AccelerationStructureImpact> impacts;
+    std::vector<AccelerationStructurePrimitive*> candidates;
+
+    for (size_t i = 0; i < SWEPT_QUERIES; i++) {
+        const aabbox3& aabbox = scene.aabboxes[i];
+        const float3& displacement = scene.displacements[i];
+
+        impacts.clear();
+
+        auto before_swept = std::chrono::high_resolution_clock::now();
+
+        acceleration_structure.query(aabbox, displacement, impacts);
+
+        auto after_swept = std::chrono::high_resolution_clock::now();
+
+        // Steps are no longer than the box, so boxes of consecutive steps overlap.
+        float min_extent = std::min({ aabbox.extent.x, aabbox.extent.y, aabbox.extent.z });
+        size_t steps = static_cast<size_t>(std::ceil(length(displacement) / (2.f * min_extent)));
+
+        candidates.clear();
+
+        auto before_stepped = std::chrono::high_resolution_clock::now();
+
+        for (size_t j = 0; j <= steps; j++) {
+            float progress = static_cast<float>(j) / static_cast<float>(steps);
+
+            aabbox3 step = aabbox;
+            step.center.x += displacement.x * progress;
+            step.center.y += displacement.y * progress;
+            step.center.z += displacement.z * progress;
+
+            acceleration_structure.query(step, candidates);
+        }
+
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+        auto after_stepped = std::chrono::high_resolution_clock::now();
+
+        swept_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after_swept - before_swept).count() / 1000000.0;
+        stepped_time += std::chrono::duration_cast<std::chrono::nanoseconds>(after_stepped - before_stepped).count() / 1000000.0;
+        impact_count += impacts.size();
+        step_count += steps + 1;
+
+        std::sort(impacts.begin(), impacts.end(), [](const AccelerationStructureImpact& lhs, const AccelerationStructureImpact& rhs) {
+            return lhs.primitive < rhs.primitive;
+        });
+
+        if (!check) {
+            scene.models[i] = impacts;
+        } else if (!std::equal(impacts.begin(), impacts.end(), scene.models[i].begin(), scene.models[i].end(), [](const AccelerationStructureImpact& lhs, const AccelerationStructureImpact& rhs) {
+            return lhs.primitive == rhs.primitive && lhs.time == rhs.time;
+        })) {
+            std::cout << "Swept query impacts don't match." << std::endl;
+            std::abort();
+        }
+    }
+
+    std::cout << " " << swept_time / SWEPT_QUERIES << " " << stepped_time / SWEPT_QUERIES << " " << static_cast<double>(impact_count) / SWEPT_QUERIES << " " << static_cast<double>(step_count) / SWEPT_QUERIES;
+
+    for (BoxPrimitive& primitive : scene.primitives) {
+        acceleration_structure.remove(primitive);
+    }
+}
+
+static void test_swept() {
+    SweptScene scene;
+    create_swept_scene(scene);
+
+    {
+        std::cout << "swept_linear";
+        CountMemoryResource memory_resource;
+        LinearAccelerationStructure acceleration_structure(memory_resource);
+        test_swept(acceleration_structure, scene, false);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "swept_octree";
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure acceleration_structure(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+        test_swept(acceleration_structure, scene, true);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "swept_quadtree";
+        CountMemoryResource memory_resource;
+        QuadtreeAccelerationStructure acceleration_structure(memory_resource, float2{}, float2{ 1024.f, 1024.f }, MAX_DEPTH);
+        test_swept(acceleration_structure, scene, true);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "swept_adaptive_octree";
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure acceleration_structure(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, ADAPTIVE_MAX_DEPTH, ADAPTIVE_SPLIT_THRESHOLD, ADAPTIVE_MERGE_THRESHOLD);
+        test_swept(acceleration_structure, scene, true);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "swept_adaptive_quadtree";
+        CountMemoryResource memory_resource;
+        QuadtreeAccelerationStructure acceleration_structure(memory_resource, float2{}, float2{ 1024.f, 1024.f }, ADAPTIVE_MAX_DEPTH, ADAPTIVE_SPLIT_THRESHOLD, ADAPTIVE_MERGE_THRESHOLD);
+        test_swept(acceleration_structure, scene, true);
+        std::cout << std::endl;
+    }
+}
+
+// Compares building an acceleration structure primitive by primitive with mapping its compact copy from a file.
+template <typename CompactTree, typename Tree>
+static void test_load(Tree& tree, std::vector<TestPrimitive>& primitives) {
+    reset_primitives(primitives);
+
+    std::vector<AccelerationStructurePrimitive*> primitive_table = get_primitive_table(primitives);
+
+    CountMemoryResource model_memory_resource;
+    LinearAccelerationStructure model(model_memory_resource);
+
+    test_add(model, primitives, false);
+    test_query_aabbox(model, primitives.size(), false, false);
+    test_query_frustum(model, primitives.size(), false, false);
+
+    test_add(tree, primitives);
+
+    CountMemoryResource memory_resource;
+
+    if (!CompactTree(memory_resource, tree).save(LOAD_PATH)) {
+        std::cout << "Failed to save compact acceleration structure." << std::endl;
+        std::abort();
+    }
+
+    for (TestPrimitive& primitive : primitives) {
+        tree.remove(primitive);
+    }
+
+    {
+        auto before = std::chrono::high_resolution_clock::now();
+
+        MappedFile file;
+        if (!file.open(LOAD_PATH) || !CompactTree::validate(file.get_data(), file.get_size())) {
+            std::cout << "Failed to load compact acceleration structure." << std::endl;
+            std::abort();
+        }
+
+        CompactTree compact_tree(memory_resource, file.get_data(), file.get_size());
+
+        auto after = std::chrono::high_resolution_clock::now();
+
+        std::cout << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count() / 1000000.0;
+
+        compact_tree.set_primitives(primitive_table.data());
+
+        test_query_aabbox(compact_tree, primitives.size(), true);
+        test_query_frustum(compact_tree, primitives.size(), true);
+    }
+
+    std::remove(LOAD_PATH);
+}
+
+static void test_load(std::vector<TestPrimitive>& primitives) {
+    {
+        std::cout << "load_octree";
+        CountMemoryResource memory_resource;
+        OctreeAccelerationStructure acceleration_structure(memory_resource, float3{}, float3{ 1024.f, 1024.f, 1024.f }, MAX_DEPTH);
+        test_load<CompactOctree>(acceleration_structure, primitives);
+        std::cout << std::endl;
+    }
+
+    {
+        std::cout << "load_quadtree";
+        CountMemoryResource memory_resource;
+        QuadtreeAccelerationStructure acceleration_structure(memory_resource, float2{}, float2{ 1024.f, 1024.f }, MAX_DEPTH);
+        test_load<CompactQuadtree>(acceleration_structure, primitives);
+        std::cout << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    for (aabbox3& aabbox : aabboxes) {
+        aabbox.center.x = center_distribution(generator);
+        aabbox.center.y = center_distribution(generator);
+        aabbox.center.z = center_distribution(generator);
+        aabbox.extent.x = query_extent_distribution(generator);
+        aabbox.extent.y = query_extent_distribution(generator);
+        aabbox.extent.z = query_extent_distribution(generator);
+    }
+
+    for (frustum& frustum : frustums) {
+        float3 source;
+        source.x = center_distribution(generator);
+        source.y = center_distribution(generator);
+        source.z = center_distribution(generator);
+
+        float3 target;
+        target.x = center_distribution(generator);
+        target.y = center_distribution(generator);
+        target.z = center_distribution(generator);
+
+        float3 up;
+        up.x = 0.f;
+        up.y = 1.f;
+        up.z = 0.f;
+
+        float4x4 view = look_at(source, target, up);
+
+        float fov = query_fov_distribution(generator);
+        float aspect = query_aspect_distribution(generator);
+        float z_near = query_near_distribution(generator);
+        float z_far = query_far_distribution(generator);
+
+        float4x4 projection = perspective(fov, aspect, z_near, z_far);
+
+        float4x4 view_projection = mul(view, projection);
+
+        frustum = frustum_from_float4x4(view_projection);
+    }
+
+    for (std::vector<AccelerationStructurePrimitive*>& model : aabbox_model) {
+        model.reserve(MAX_PRIMITIVES);
+    }
+
+    for (std::vector<AccelerationStructurePrimitive*>& check : aabbox_check) {
+        check.reserve(MAX_PRIMITIVES);
+    }
+
+    for (std::vector<AccelerationStructurePrimitive*>& model : frustum_model) {
+        model.reserve(MAX_PRIMITIVES);
+    }
+
+    for (std::vector<AccelerationStructurePrimitive*>& check : frustum_check) {
+        check.reserve(MAX_PRIMITIVES);
+    }
+
+    // Perform this test multiple times, use average for statistics.
+    for (size_t i = 0; i < 5; i++) {
+        for (size_t n = MIN_PRIMITIVES; n <= MAX_PRIMITIVES; n *= 2) {
+            std::cout << n;
+
+            // Primitive addresses must be the same for all acceleration structures.
+            std::vector<TestPrimitive> primitives(n);
+
+            test_linear_acceleration_structure(primitives);
+            test_octree_acceleration_structure(primitives);
+            test_quadtree_acceleration_structure(primitives);
+            test_adaptive_octree_acceleration_structure(primitives);
+            test_adaptive_quadtree_acceleration_structure(primitives);
+            test_sweep_and_prune_acceleration_structure(primitives);
+            test_compact_octree(primitives);
+            test_compact_quadtree(primitives);
+
+            std::cout << std::endl;
+        }
+    }
+
+    std::vector<TestPrimitive> drift_primitives(DRIFT_PRIMITIVES);
+    test_drift(drift_primitives);
+
+    std::vector<TestPrimitive> coherence_primitives(COHERENCE_PRIMITIVES);
+    test_coherence(coherence_primitives);
+
+    test_occlusion();
+
+    std::vector<TestPrimitive> screen_size_primitives(SCREEN_SIZE_PRIMITIVES);
+    test_screen_size(screen_size_primitives);
+
+    std::vector<TestPrimitive> static_dynamic_primitives(STATIC_DYNAMIC_PRIMITIVES);
+    test_static_dynamic(static_dynamic_primitives);
+
+    std::vector<TestPrimitive> async_primitives(ASYNC_PRIMITIVES);
+    test_async(async_primitives);
+
+    std::vector<TestPrimitive> bitset_primitives(BITSET_PRIMITIVES);
+    test_bitset(bitset_primitives);
+
+    std::vector<TestPrimitive> memory_primitives(MEMORY_PRIMITIVES);
+    test_memory(memory_primitives);
+
+    test_streaming();
+
+    test_swept();
+
+    std::vector<TestPrimitive> load_primitives(MAX_PRIMITIVES);
+    test_load(load_primitives);
+
     return 0;
 }
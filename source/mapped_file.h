@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const char* path) {
+        close();
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+            CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+
+        if (mapping == nullptr) {
+            return false;
+        }
+
+        m_data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+
+        if (m_data == nullptr) {
+            return false;
+        }
+
+        m_size = static_cast<size_t>(size.QuadPart);
+#else
+        int file = ::open(path, O_RDONLY);
+        if (file < 0) {
+            return false;
+        }
+
+        struct stat status;
+        if (fstat(file, &status) != 0 || status.st_size == 0) {
+            ::close(file);
+            return false;
+        }
+
+        void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        ::close(file);
+
+        if (data == MAP_FAILED) {
+            return false;
+        }
+
+        m_data = data;
+        m_size = static_cast<size_t>(status.st_size);
+#endif
+
+        return true;
+    }
+
+    void close() {
+        if (m_data != nullptr) {
+#ifdef _WIN32
+            UnmapViewOfFile(m_data);
+#else
+            munmap(m_data, m_size);
+#endif
+            m_data = nullptr;
+            m_size = 0;
+        }
+    }
+
+    const void* get_data() const {
+        return m_data;
+    }
+
+    size_t get_size() const {
+        return m_size;
+    }
+
+private:
+    void* m_data = nullptr;
+    size_t m_size = 0;
+};
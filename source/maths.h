@@ -1,6 +1,16 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// SSE2 is always available on x86-64, other targets use scalar code.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATHS_SSE2
+#include <emmintrin.h>
+#endif
 
 struct float2 {
     float x;
@@ -27,6 +37,23 @@ struct aabbox3 {
     float3 extent;
 };
 
+// Four boxes in structure of arrays layout, so they're tested against the same query at once.
+struct aabbox2x4 {
+    float center_x[4];
+    float center_y[4];
+    float extent_x[4];
+    float extent_y[4];
+};
+
+struct aabbox3x4 {
+    float center_x[4];
+    float center_y[4];
+    float center_z[4];
+    float extent_x[4];
+    float extent_y[4];
+    float extent_z[4];
+};
+
 struct plane {
     float3 normal;
     float distance;
@@ -179,3 +206,256 @@ inline bool intersect(const aabbox3& lhs, const frustum& rhs) {
     }
     return true;
 }
+
+// Whether the box is in front of all planes by more than floating point error (relative to the values involved), so
+// any box inside of it passes the test above.
+inline bool contains(const frustum& lhs, const aabbox3& rhs) {
+    float3 reach{ std::abs(rhs.center.x) + rhs.extent.x, std::abs(rhs.center.y) + rhs.extent.y, std::abs(rhs.center.z) + rhs.extent.z };
+    for (const plane& plane : lhs.data) {
+        float3 abs_normal{ std::abs(plane.normal.x), std::abs(plane.normal.y), std::abs(plane.normal.z) };
+        float tolerance = 1e-4f * (1.f + std::abs(plane.distance) + dot(reach, abs_normal));
+        if (dot(rhs.center, plane.normal) + plane.distance - dot(rhs.extent, abs_normal) <= tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline aabbox2 get_aabbox(const aabbox2x4& boxes, size_t index) {
+    return aabbox2{
+        float2{ boxes.center_x[index], boxes.center_y[index] },
+        float2{ boxes.extent_x[index], boxes.extent_y[index] }
+    };
+}
+
+inline aabbox3 get_aabbox(const aabbox3x4& boxes, size_t index) {
+    return aabbox3{
+        float3{ boxes.center_x[index], boxes.center_y[index], boxes.center_z[index] },
+        float3{ boxes.extent_x[index], boxes.extent_y[index], boxes.extent_z[index] }
+    };
+}
+
+inline void set_aabbox(aabbox2x4& boxes, size_t index, const aabbox2& value) {
+    boxes.center_x[index] = value.center.x;
+    boxes.center_y[index] = value.center.y;
+    boxes.extent_x[index] = value.extent.x;
+    boxes.extent_y[index] = value.extent.y;
+}
+
+inline void set_aabbox(aabbox3x4& boxes, size_t index, const aabbox3& value) {
+    boxes.center_x[index] = value.center.x;
+    boxes.center_y[index] = value.center.y;
+    boxes.center_z[index] = value.center.z;
+    boxes.extent_x[index] = value.extent.x;
+    boxes.extent_y[index] = value.extent.y;
+    boxes.extent_z[index] = value.extent.z;
+}
+
+// Narrows the time range to when the boxes overlap along one axis. `distance` is from the moving box to the other one
+// and `reach` is the sum of their extents. When the box doesn't move along the axis, the range is kept or emptied.
+inline bool sweep_axis(float distance, float reach, float velocity, float& enter, float& exit) {
+    if (velocity == 0.f) {
+        return std::abs(distance) <= reach;
+    }
+
+    float first = (distance - reach) / velocity;
+    float last = (distance + reach) / velocity;
+    if (velocity < 0.f) {
+        std::swap(first, last);
+    }
+
+    enter = std::max(enter, first);
+    exit = std::min(exit, last);
+    return enter <= exit;
+}
+
+// Whether the box touches the other box while it moves by the displacement. `time` is the fraction of the displacement
+// when they first touch, zero when they intersect from the start. Without displacement it's the same as `intersect`.
+inline bool intersect(const aabbox3& lhs, const float3& displacement, const aabbox3& rhs, float& time) {
+    float enter = 0.f;
+    float exit = 1.f;
+
+    if (sweep_axis(rhs.center.x - lhs.center.x, lhs.extent.x + rhs.extent.x, displacement.x, enter, exit) &&
+        sweep_axis(rhs.center.y - lhs.center.y, lhs.extent.y + rhs.extent.y, displacement.y, enter, exit) &&
+        sweep_axis(rhs.center.z - lhs.center.z, lhs.extent.z + rhs.extent.z, displacement.z, enter, exit)) {
+        time = enter;
+        return true;
+    }
+
+    return false;
+}
+
+// Same for a 2D box that is unbounded along Y, whose Y is the 3D Z.
+inline bool intersect(const aabbox3& lhs, const float3& displacement, const aabbox2& rhs, float& time) {
+    float enter = 0.f;
+    float exit = 1.f;
+
+    if (sweep_axis(rhs.center.x - lhs.center.x, lhs.extent.x + rhs.extent.x, displacement.x, enter, exit) &&
+        sweep_axis(rhs.center.y - lhs.center.z, lhs.extent.z + rhs.extent.y, displacement.z, enter, exit)) {
+        time = enter;
+        return true;
+    }
+
+    return false;
+}
+
+// Bounds of all positions of the box while it moves by the displacement.
+inline aabbox3 get_swept_bounds(const aabbox3& bounds, const float3& displacement) {
+    return aabbox3{
+        float3{ bounds.center.x + displacement.x / 2.f, bounds.center.y + displacement.y / 2.f, bounds.center.z + displacement.z / 2.f },
+        float3{ bounds.extent.x + std::abs(displacement.x) / 2.f, bounds.extent.y + std::abs(displacement.y) / 2.f, bounds.extent.z + std::abs(displacement.z) / 2.f }
+    };
+}
+
+// Frustum planes with the Y axis folded into the plane distance, for boxes that span the given Y range. 2D boxes are
+// tested against it like 3D boxes that span the range, the same way their Y is the 3D Z.
+struct frustum_slab {
+    float normal_x[6];
+    float normal_z[6];
+    float distance[6];
+};
+
+inline frustum_slab frustum_slab_from_frustum(const frustum& frustum, float y_center, float y_extent) {
+    frustum_slab result;
+    for (size_t i = 0; i < 6; i++) {
+        const plane& plane = frustum.data[i];
+        result.normal_x[i] = plane.normal.x;
+        result.normal_z[i] = plane.normal.z;
+        result.distance[i] = plane.distance + (y_center * plane.normal.y + y_extent * std::abs(plane.normal.y));
+    }
+    return result;
+}
+
+inline bool intersect(const aabbox2& lhs, const frustum_slab& rhs) {
+    for (size_t i = 0; i < 6; i++) {
+        float center = lhs.center.x * rhs.normal_x[i] + lhs.center.y * rhs.normal_z[i];
+        float extent = lhs.extent.x * std::abs(rhs.normal_x[i]) + lhs.extent.y * std::abs(rhs.normal_z[i]);
+        if (center + rhs.distance[i] + extent < 0.f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Batch versions of the tests above. Bit `i` of the result is set when box `i` passes, they give the same results as
+// testing the boxes one by one.
+inline uint32_t intersect(const aabbox2x4& lhs, const aabbox3& rhs) {
+#ifdef MATHS_SSE2
+    __m128 sign = _mm_set1_ps(-0.f);
+    __m128 x = _mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(lhs.center_x), _mm_set1_ps(rhs.center.x))), _mm_add_ps(_mm_loadu_ps(lhs.extent_x), _mm_set1_ps(rhs.extent.x)));
+    __m128 y = _mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(lhs.center_y), _mm_set1_ps(rhs.center.z))), _mm_add_ps(_mm_loadu_ps(lhs.extent_y), _mm_set1_ps(rhs.extent.z)));
+    return static_cast<uint32_t>(_mm_movemask_ps(_mm_and_ps(x, y)));
+#else
+    uint32_t result = 0;
+    for (size_t i = 0; i < 4; i++) {
+        result |= static_cast<uint32_t>(intersect(get_aabbox(lhs, i), rhs)) << i;
+    }
+    return result;
+#endif
+}
+
+inline uint32_t intersect(const aabbox3x4& lhs, const aabbox3& rhs) {
+#ifdef MATHS_SSE2
+    __m128 sign = _mm_set1_ps(-0.f);
+    __m128 x = _mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(lhs.center_x), _mm_set1_ps(rhs.center.x))), _mm_add_ps(_mm_loadu_ps(lhs.extent_x), _mm_set1_ps(rhs.extent.x)));
+    __m128 y = _mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(lhs.center_y), _mm_set1_ps(rhs.center.y))), _mm_add_ps(_mm_loadu_ps(lhs.extent_y), _mm_set1_ps(rhs.extent.y)));
+    __m128 z = _mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(lhs.center_z), _mm_set1_ps(rhs.center.z))), _mm_add_ps(_mm_loadu_ps(lhs.extent_z), _mm_set1_ps(rhs.extent.z)));
+    return static_cast<uint32_t>(_mm_movemask_ps(_mm_and_ps(_mm_and_ps(x, y), z)));
+#else
+    uint32_t result = 0;
+    for (size_t i = 0; i < 4; i++) {
+        result |= static_cast<uint32_t>(intersect(get_aabbox(lhs, i), rhs)) << i;
+    }
+    return result;
+#endif
+}
+
+inline uint32_t intersect(const aabbox3x4& lhs, const frustum& rhs) {
+#ifdef MATHS_SSE2
+    __m128 sign = _mm_set1_ps(-0.f);
+    __m128 zero = _mm_setzero_ps();
+
+    __m128 center_x = _mm_loadu_ps(lhs.center_x);
+    __m128 center_y = _mm_loadu_ps(lhs.center_y);
+    __m128 center_z = _mm_loadu_ps(lhs.center_z);
+    __m128 extent_x = _mm_loadu_ps(lhs.extent_x);
+    __m128 extent_y = _mm_loadu_ps(lhs.extent_y);
+    __m128 extent_z = _mm_loadu_ps(lhs.extent_z);
+
+    // Operations are in the same order as in the scalar test, so the results are exactly the same.
+    __m128 outside = zero;
+    for (const plane& plane : rhs.data) {
+        __m128 normal_x = _mm_set1_ps(plane.normal.x);
+        __m128 normal_y = _mm_set1_ps(plane.normal.y);
+        __m128 normal_z = _mm_set1_ps(plane.normal.z);
+
+        __m128 center = _mm_add_ps(_mm_add_ps(_mm_mul_ps(center_x, normal_x), _mm_mul_ps(center_y, normal_y)), _mm_mul_ps(center_z, normal_z));
+        __m128 extent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(extent_x, _mm_andnot_ps(sign, normal_x)), _mm_mul_ps(extent_y, _mm_andnot_ps(sign, normal_y))), _mm_mul_ps(extent_z, _mm_andnot_ps(sign, normal_z)));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(_mm_add_ps(center, _mm_set1_ps(plane.distance)), extent), zero));
+    }
+
+    return static_cast<uint32_t>(~_mm_movemask_ps(outside)) & 0xF;
+#else
+    uint32_t result = 0;
+    for (size_t i = 0; i < 4; i++) {
+        result |= static_cast<uint32_t>(intersect(get_aabbox(lhs, i), rhs)) << i;
+    }
+    return result;
+#endif
+}
+
+inline uint32_t intersect(const aabbox2x4& lhs, const frustum_slab& rhs) {
+#ifdef MATHS_SSE2
+    __m128 sign = _mm_set1_ps(-0.f);
+    __m128 zero = _mm_setzero_ps();
+
+    __m128 center_x = _mm_loadu_ps(lhs.center_x);
+    __m128 center_y = _mm_loadu_ps(lhs.center_y);
+    __m128 extent_x = _mm_loadu_ps(lhs.extent_x);
+    __m128 extent_y = _mm_loadu_ps(lhs.extent_y);
+
+    __m128 outside = zero;
+    for (size_t i = 0; i < 6; i++) {
+        __m128 normal_x = _mm_set1_ps(rhs.normal_x[i]);
+        __m128 normal_z = _mm_set1_ps(rhs.normal_z[i]);
+
+        __m128 center = _mm_add_ps(_mm_mul_ps(center_x, normal_x), _mm_mul_ps(center_y, normal_z));
+        __m128 extent = _mm_add_ps(_mm_mul_ps(extent_x, _mm_andnot_ps(sign, normal_x)), _mm_mul_ps(extent_y, _mm_andnot_ps(sign, normal_z)));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(_mm_add_ps(center, _mm_set1_ps(rhs.distance[i])), extent), zero));
+    }
+
+    return static_cast<uint32_t>(~_mm_movemask_ps(outside)) & 0xF;
+#else
+    uint32_t result = 0;
+    for (size_t i = 0; i < 4; i++) {
+        result |= static_cast<uint32_t>(intersect(get_aabbox(lhs, i), rhs)) << i;
+    }
+    return result;
+#endif
+}
+
+// Zero when the point is inside of the box.
+inline float distance_squared(const float3& point, const aabbox3& bounds) {
+    float x = std::max(std::abs(point.x - bounds.center.x) - bounds.extent.x, 0.f);
+    float y = std::max(std::abs(point.y - bounds.center.y) - bounds.extent.y, 0.f);
+    float z = std::max(std::abs(point.z - bounds.center.z) - bounds.extent.z, 0.f);
+    return x * x + y * y + z * z;
+}
+
+// Distance to the box's column, which is unbounded along Y. Zero when the point is inside of the column.
+inline float distance_squared(const float3& point, const aabbox2& bounds) {
+    float x = std::max(std::abs(point.x - bounds.center.x) - bounds.extent.x, 0.f);
+    float z = std::max(std::abs(point.z - bounds.center.y) - bounds.extent.y, 0.f);
+    return x * x + z * z;
+}
+
+// Whether a box with the given squared extent length projects to less than `min_size` from the given squared distance.
+// `projection_scale` is the projected size of a unit long segment at a unit distance, e.g. screen height in pixels
+// divided by `2 * tan(fov_y / 2)`.
+inline bool is_smaller(float squared_extent, float squared_distance, float projection_scale, float min_size) {
+    return 4.f * squared_extent * projection_scale * projection_scale < min_size * min_size * squared_distance;
+}
+
+inline bool is_smaller(const aabbox3& bounds, const float3& camera_position, float projection_scale, float min_size) {
+    return is_smaller(dot(bounds.extent, bounds.extent), distance_squared(camera_position, bounds), projection_scale, min_size);
+}
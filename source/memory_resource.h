@@ -0,0 +1,387 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#endif
+
+// All memory resources return memory aligned to this.
+constexpr size_t MEMORY_RESOURCE_ALIGNMENT = 16;
+
+constexpr size_t MONOTONIC_MEMORY_RESOURCE_BLOCK_SIZE = 1 << 20;
+
+// Pool memory resource serves sizes up to this from free lists, one list per multiple of the alignment.
+constexpr size_t POOL_MEMORY_RESOURCE_MAX_SIZE = 512;
+constexpr size_t POOL_MEMORY_RESOURCE_SLAB_SIZE = 64 << 10;
+
+constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
+
+inline size_t align_memory_resource_size(size_t size, size_t alignment = MEMORY_RESOURCE_ALIGNMENT) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+class MemoryResource {
+public:
+    virtual ~MemoryResource() = default;
+
+    virtual void* allocate(size_t size) = 0;
+    virtual void deallocate(void* memory, size_t size) = 0;
+
+    // Bytes the allocation takes from this resource, including rounding and bookkeeping.
+    virtual size_t get_footprint(const void*, size_t size) const {
+        return align_memory_resource_size(size);
+    }
+
+    // Same as `allocate` and `deallocate`, but also output the footprint. Resources that measure the footprint at a cost
+    // override these to measure it once.
+    virtual void* allocate_measured(size_t size, size_t& footprint) {
+        void* memory = allocate(size);
+        footprint = get_footprint(memory, size);
+        return memory;
+    }
+
+    virtual void deallocate_measured(void* memory, size_t size, size_t& footprint) {
+        footprint = get_footprint(memory, size);
+        deallocate(memory, size);
+    }
+
+    // Bytes this resource holds at the moment, whether they're allocated or not.
+    virtual size_t get_reserved() const = 0;
+};
+
+// The default resource is shared by count memory resources that may be used from different threads, so the reserved
+// bytes are counted atomically.
+class MallocMemoryResource : public MemoryResource {
+public:
+    void* allocate(size_t size) override {
+        size_t footprint;
+        return allocate_measured(size, footprint);
+    }
+
+    void deallocate(void* memory, size_t size) override {
+        size_t footprint;
+        deallocate_measured(memory, size, footprint);
+    }
+
+    void* allocate_measured(size_t size, size_t& footprint) override {
+        void* memory = std::malloc(size);
+        footprint = get_block_size(memory, size);
+        m_reserved.fetch_add(footprint, std::memory_order_relaxed);
+        return memory;
+    }
+
+    void deallocate_measured(void* memory, size_t size, size_t& footprint) override {
+        footprint = get_block_size(memory, size);
+        m_reserved.fetch_sub(footprint, std::memory_order_relaxed);
+        std::free(memory);
+    }
+
+    size_t get_footprint(const void* memory, size_t size) const override {
+        return get_block_size(const_cast<void*>(memory), size);
+    }
+
+    size_t get_reserved() const override {
+        return m_reserved.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Usable size of the block plus the size field that precedes it.
+#if defined(__GLIBC__)
+    static size_t get_block_size(void* memory, size_t) {
+        return malloc_usable_size(memory) + sizeof(size_t);
+    }
+#elif defined(_WIN32)
+    static size_t get_block_size(void* memory, size_t) {
+        return _msize(memory) + MEMORY_RESOURCE_ALIGNMENT;
+    }
+#else
+    static size_t get_block_size(void*, size_t size) {
+        return align_memory_resource_size(size + sizeof(size_t));
+    }
+#endif
+
+    std::atomic<size_t> m_reserved{ 0 };
+};
+
+inline MallocMemoryResource& get_malloc_memory_resource() {
+    static MallocMemoryResource memory_resource;
+    return memory_resource;
+}
+
+// Bump allocator over blocks taken from the upstream resource. Deallocation is a no-op, memory is returned to the
+// upstream resource when the monotonic resource is destroyed.
+class MonotonicMemoryResource : public MemoryResource {
+public:
+    MonotonicMemoryResource(MemoryResource& upstream, size_t block_size = MONOTONIC_MEMORY_RESOURCE_BLOCK_SIZE)
+        : m_upstream(upstream)
+        , m_block_size(block_size)
+    {
+    }
+
+    MonotonicMemoryResource(const MonotonicMemoryResource&) = delete;
+    MonotonicMemoryResource& operator=(const MonotonicMemoryResource&) = delete;
+
+    ~MonotonicMemoryResource() override {
+        while (m_blocks != nullptr) {
+            Block* next = m_blocks->next;
+            m_upstream.deallocate(m_blocks, m_blocks->size);
+            m_blocks = next;
+        }
+    }
+
+    void* allocate(size_t size) override {
+        size = align_memory_resource_size(size);
+
+        if (m_blocks == nullptr || m_offset + size > m_blocks->size) {
+            size_t block_size = std::max(m_block_size, sizeof(Block) + size);
+
+            Block* block = static_cast<Block*>(m_upstream.allocate(block_size));
+            block->next = m_blocks;
+            block->size = block_size;
+
+            m_blocks = block;
+            m_offset = sizeof(Block);
+            m_reserved += block_size;
+        }
+
+        void* memory = reinterpret_cast<char*>(m_blocks) + m_offset;
+        m_offset += size;
+        return memory;
+    }
+
+    void deallocate(void*, size_t) override {
+        // No-op.
+    }
+
+    size_t get_reserved() const override {
+        return m_reserved;
+    }
+
+private:
+    struct alignas(MEMORY_RESOURCE_ALIGNMENT) Block {
+        Block* next;
+        size_t size;
+    };
+
+    MemoryResource& m_upstream;
+    size_t m_block_size;
+
+    Block* m_blocks = nullptr;
+    size_t m_offset = 0;
+    size_t m_reserved = 0;
+};
+
+// Serves small sizes from free lists of fixed size slots, carved from slabs taken from the upstream resource. Slabs
+// are returned to the upstream resource when the pool is destroyed. Larger sizes go straight to the large upstream
+// resource, which is the same as the upstream resource unless slabs are too coarse for them (e.g. huge pages).
+class PoolMemoryResource : public MemoryResource {
+public:
+    PoolMemoryResource(MemoryResource& upstream, size_t slab_size = POOL_MEMORY_RESOURCE_SLAB_SIZE)
+        : PoolMemoryResource(upstream, upstream, slab_size)
+    {
+    }
+
+    PoolMemoryResource(MemoryResource& upstream, MemoryResource& large_upstream, size_t slab_size = POOL_MEMORY_RESOURCE_SLAB_SIZE)
+        : m_upstream(upstream)
+        , m_large_upstream(large_upstream)
+        , m_slab_size(slab_size)
+    {
+        assert(slab_size >= sizeof(Slab) + POOL_MEMORY_RESOURCE_MAX_SIZE);
+    }
+
+    PoolMemoryResource(const PoolMemoryResource&) = delete;
+    PoolMemoryResource& operator=(const PoolMemoryResource&) = delete;
+
+    ~PoolMemoryResource() override {
+        while (m_slabs != nullptr) {
+            Slab* next = m_slabs->next;
+            m_upstream.deallocate(m_slabs, m_slab_size);
+            m_slabs = next;
+        }
+    }
+
+    void* allocate(size_t size) override {
+        if (size > POOL_MEMORY_RESOURCE_MAX_SIZE) {
+            size_t footprint;
+            void* memory = m_large_upstream.allocate_measured(size, footprint);
+            m_reserved += footprint;
+            return memory;
+        }
+
+        size_t index = get_list_index(size);
+
+        if (m_lists[index] == nullptr) {
+            refill(index);
+        }
+
+        Slot* slot = m_lists[index];
+        m_lists[index] = slot->next;
+        return slot;
+    }
+
+    void deallocate(void* memory, size_t size) override {
+        if (size > POOL_MEMORY_RESOURCE_MAX_SIZE) {
+            size_t footprint;
+            m_large_upstream.deallocate_measured(memory, size, footprint);
+            m_reserved -= footprint;
+            return;
+        }
+
+        size_t index = get_list_index(size);
+
+        Slot* slot = static_cast<Slot*>(memory);
+        slot->next = m_lists[index];
+        m_lists[index] = slot;
+    }
+
+    size_t get_footprint(const void* memory, size_t size) const override {
+        return size > POOL_MEMORY_RESOURCE_MAX_SIZE ? m_large_upstream.get_footprint(memory, size) : align_memory_resource_size(size);
+    }
+
+    size_t get_reserved() const override {
+        return m_reserved;
+    }
+
+private:
+    struct Slot {
+        Slot* next;
+    };
+
+    struct alignas(MEMORY_RESOURCE_ALIGNMENT) Slab {
+        Slab* next;
+    };
+
+    static size_t get_list_index(size_t size) {
+        return (std::max<size_t>(size, 1) - 1) / MEMORY_RESOURCE_ALIGNMENT;
+    }
+
+    // Carves a new slab into slots of the list's size.
+    void refill(size_t index) {
+        size_t footprint;
+        Slab* slab = static_cast<Slab*>(m_upstream.allocate_measured(m_slab_size, footprint));
+        slab->next = m_slabs;
+        m_slabs = slab;
+        m_reserved += footprint;
+
+        size_t slot_size = (index + 1) * MEMORY_RESOURCE_ALIGNMENT;
+        char* first = reinterpret_cast<char*>(slab) + sizeof(Slab);
+        size_t count = (m_slab_size - sizeof(Slab)) / slot_size;
+
+        for (size_t i = count; i > 0; i--) {
+            Slot* slot = reinterpret_cast<Slot*>(first + (i - 1) * slot_size);
+            slot->next = m_lists[index];
+            m_lists[index] = slot;
+        }
+    }
+
+    MemoryResource& m_upstream;
+    MemoryResource& m_large_upstream;
+    size_t m_slab_size;
+
+    Slot* m_lists[POOL_MEMORY_RESOURCE_MAX_SIZE / MEMORY_RESOURCE_ALIGNMENT] = {};
+    Slab* m_slabs = nullptr;
+    size_t m_reserved = 0;
+};
+
+// Maps every allocation separately, rounded up to whole huge pages. Meant as the upstream resource of the monotonic
+// resource or of the pool resource's slabs, so that the memory of an acceleration structure needs fewer TLB entries.
+// Falls back to regular pages when huge pages are not available.
+class HugePageMemoryResource : public MemoryResource {
+public:
+    void* allocate(size_t size) override {
+        size = get_footprint(nullptr, size);
+
+#ifdef _WIN32
+        void* memory = nullptr;
+
+        // Large pages require the "Lock pages in memory" privilege.
+        SIZE_T large_page_size = GetLargePageMinimum();
+        if (large_page_size != 0 && size % large_page_size == 0) {
+            memory = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        }
+
+        if (memory == nullptr) {
+            memory = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        }
+
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+#else
+        void* memory = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+        // Only works when huge pages are reserved by the system.
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+        if (memory == MAP_FAILED) {
+            // Transparent huge pages need an aligned range, so an extra page is mapped and the misaligned ends are unmapped.
+            char* mapping = static_cast<char*>(mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if (mapping == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+
+            char* aligned = reinterpret_cast<char*>(align_memory_resource_size(reinterpret_cast<uintptr_t>(mapping), HUGE_PAGE_SIZE));
+
+            if (aligned != mapping) {
+                munmap(mapping, aligned - mapping);
+            }
+            if (aligned + size != mapping + size + HUGE_PAGE_SIZE) {
+                munmap(aligned + size, mapping + HUGE_PAGE_SIZE - aligned);
+            }
+
+#ifdef MADV_HUGEPAGE
+            madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+
+            memory = aligned;
+        }
+#endif
+
+        m_reserved += size;
+        return memory;
+    }
+
+    void deallocate(void* memory, size_t size) override {
+        size = get_footprint(memory, size);
+        m_reserved -= size;
+
+#ifdef _WIN32
+        VirtualFree(memory, 0, MEM_RELEASE);
+#else
+        munmap(memory, size);
+#endif
+    }
+
+    size_t get_footprint(const void*, size_t size) const override {
+        return align_memory_resource_size(size, HUGE_PAGE_SIZE);
+    }
+
+    size_t get_reserved() const override {
+        return m_reserved;
+    }
+
+private:
+    size_t m_reserved = 0;
+};
@@ -0,0 +1,390 @@
+#pragma once
+
+#include "count_allocator.h"
+#include "maths.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Box corner `i` takes the maximum along X, Y and Z when bit 0, 1 and 2 of `i` are set respectively.
+// Faces are listed counter-clockwise when looking at them from outside.
+static const uint32_t OCCLUSION_BUFFER_FACES[6][4] = {
+    { 5, 1, 3, 7 }, // +X
+    { 0, 4, 6, 2 }, // -X
+    { 2, 6, 7, 3 }, // +Y
+    { 0, 1, 5, 4 }, // -Y
+    { 4, 5, 7, 6 }, // +Z
+    { 0, 2, 3, 1 }, // -Z
+};
+
+struct OcclusionBufferVertex {
+    float x;
+    float y;
+    float z;
+    float w;
+};
+
+// Low resolution depth of the nearest occluders, followed by a hierarchical-Z mip chain where each texel holds the
+// farthest depth of the four texels below it. Depth is 0 at the near plane and 1 at the far plane.
+//
+// Rasterization is conservative: a pixel is covered only when an occluder covers all of it, and it's given the farthest
+// depth of the occluder within the pixel. So a primitive is never reported occluded when any part of it is visible.
+class OcclusionBuffer {
+public:
+    // Width must be a multiple of 4, so rows are rasterized 4 pixels at a time.
+    OcclusionBuffer(CountMemoryResource& memory_resource, uint32_t width, uint32_t height)
+        : m_depth(memory_resource)
+        , m_width(width)
+        , m_height(height)
+    {
+        assert(width > 0 && width % 4 == 0);
+        assert(height > 0);
+
+        size_t size = 0;
+
+        for (uint32_t level_width = width, level_height = height;; level_width = std::max(level_width / 2, 1u), level_height = std::max(level_height / 2, 1u)) {
+            m_levels.push_back(Level{ size, level_width, level_height });
+            size += static_cast<size_t>(level_width) * level_height;
+
+            if (level_width == 1 && level_height == 1) {
+                break;
+            }
+        }
+
+        m_depth.resize(size, 1.f);
+    }
+
+    uint32_t get_width() const {
+        return m_width;
+    }
+
+    uint32_t get_height() const {
+        return m_height;
+    }
+
+    // Must be called before occluders are added for a new view.
+    void clear(const float4x4& view_projection) {
+        m_view_projection = view_projection;
+        std::fill(m_depth.begin(), m_depth.end(), 1.f);
+    }
+
+    void add_occluder(const aabbox3& bounds) {
+        OcclusionBufferVertex corners[8];
+        transform_corners(bounds, corners);
+
+        for (const uint32_t (&face)[4] : OCCLUSION_BUFFER_FACES) {
+            OcclusionBufferVertex polygon[8];
+            uint32_t count = clip_near(corners, face, polygon);
+
+            // Rows go downwards, so counter-clockwise faces are flipped to have positive area on the screen.
+            for (uint32_t i = 2; i < count; i++) {
+                rasterize(polygon[0], polygon[i], polygon[i - 1]);
+            }
+        }
+    }
+
+    // Must be called after occluders are added and before primitives are tested.
+    void build() {
+        for (size_t i = 1; i < m_levels.size(); i++) {
+            const Level& source = m_levels[i - 1];
+            const Level& destination = m_levels[i];
+
+            for (uint32_t y = 0; y < destination.height; y++) {
+                // Odd sizes are rounded down, so the last row and column of the source are folded in too.
+                uint32_t y0 = std::min(y * 2, source.height - 1);
+                uint32_t y1 = y + 1 == destination.height ? source.height - 1 : std::min(y * 2 + 1, source.height - 1);
+
+                for (uint32_t x = 0; x < destination.width; x++) {
+                    uint32_t x0 = std::min(x * 2, source.width - 1);
+                    uint32_t x1 = x + 1 == destination.width ? source.width - 1 : std::min(x * 2 + 1, source.width - 1);
+
+                    float depth = 0.f;
+                    for (uint32_t source_y = y0; source_y <= y1; source_y++) {
+                        for (uint32_t source_x = x0; source_x <= x1; source_x++) {
+                            depth = std::max(depth, m_depth[source.offset + source_y * source.width + source_x]);
+                        }
+                    }
+
+                    m_depth[destination.offset + y * destination.width + x] = depth;
+                }
+            }
+        }
+    }
+
+    // Boxes crossing the near plane or not on the screen are never occluded.
+    bool is_occluded(const aabbox3& bounds) const {
+        float min_x;
+        float min_y;
+        float max_x;
+        float max_y;
+        float min_depth;
+
+#ifdef MATHS_SSE2
+        const float (&m)[4][4] = m_view_projection.data;
+
+        // Corners 0-3 and 4-7 only differ in Z, so each group is transformed four at a time.
+        __m128 x = _mm_mul_ps(_mm_setr_ps(-1.f, 1.f, -1.f, 1.f), _mm_set1_ps(bounds.extent.x));
+        __m128 y = _mm_mul_ps(_mm_setr_ps(-1.f, -1.f, 1.f, 1.f), _mm_set1_ps(bounds.extent.y));
+
+        __m128 low[4];
+        __m128 high[4];
+
+        for (size_t i = 0; i < 4; i++) {
+            float center = bounds.center.x * m[0][i] + bounds.center.y * m[1][i] + bounds.center.z * m[2][i] + m[3][i];
+            __m128 base = _mm_add_ps(_mm_set1_ps(center), _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[0][i])), _mm_mul_ps(y, _mm_set1_ps(m[1][i]))));
+            __m128 z = _mm_set1_ps(bounds.extent.z * m[2][i]);
+            low[i] = _mm_sub_ps(base, z);
+            high[i] = _mm_add_ps(base, z);
+        }
+
+        __m128 zero = _mm_setzero_ps();
+        if (_mm_movemask_ps(_mm_or_ps(_mm_cmplt_ps(low[2], zero), _mm_cmplt_ps(high[2], zero))) != 0) {
+            return false;
+        }
+
+        __m128 half = _mm_set1_ps(0.5f);
+        __m128 width = _mm_set1_ps(static_cast<float>(m_width));
+        __m128 height = _mm_set1_ps(static_cast<float>(m_height));
+
+        __m128 low_x = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_div_ps(low[0], low[3]), half), half), width);
+        __m128 high_x = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_div_ps(high[0], high[3]), half), half), width);
+        __m128 low_y = _mm_mul_ps(_mm_sub_ps(half, _mm_mul_ps(_mm_div_ps(low[1], low[3]), half)), height);
+        __m128 high_y = _mm_mul_ps(_mm_sub_ps(half, _mm_mul_ps(_mm_div_ps(high[1], high[3]), half)), height);
+
+        min_x = horizontal_min(_mm_min_ps(low_x, high_x));
+        min_y = horizontal_min(_mm_min_ps(low_y, high_y));
+        max_x = horizontal_max(_mm_max_ps(low_x, high_x));
+        max_y = horizontal_max(_mm_max_ps(low_y, high_y));
+        min_depth = horizontal_min(_mm_min_ps(_mm_div_ps(low[2], low[3]), _mm_div_ps(high[2], high[3])));
+#else
+        OcclusionBufferVertex corners[8];
+        transform_corners(bounds, corners);
+
+        min_x = FLT_MAX;
+        min_y = FLT_MAX;
+        max_x = -FLT_MAX;
+        max_y = -FLT_MAX;
+        min_depth = FLT_MAX;
+
+        for (const OcclusionBufferVertex& corner : corners) {
+            if (corner.z < 0.f) {
+                return false;
+            }
+
+            float x = get_screen_x(corner);
+            float y = get_screen_y(corner);
+
+            min_x = std::min(min_x, x);
+            min_y = std::min(min_y, y);
+            max_x = std::max(max_x, x);
+            max_y = std::max(max_y, y);
+            min_depth = std::min(min_depth, corner.z / corner.w);
+        }
+#endif
+
+        if (max_x < 0.f || max_y < 0.f || min_x >= static_cast<float>(m_width) || min_y >= static_cast<float>(m_height)) {
+            return false;
+        }
+
+        uint32_t x0 = static_cast<uint32_t>(std::max(min_x, 0.f));
+        uint32_t y0 = static_cast<uint32_t>(std::max(min_y, 0.f));
+        uint32_t x1 = static_cast<uint32_t>(std::min(max_x, static_cast<float>(m_width - 1)));
+        uint32_t y1 = static_cast<uint32_t>(std::min(max_y, static_cast<float>(m_height - 1)));
+
+        // The coarsest level where the box touches at most 2x2 texels.
+        size_t level = 0;
+        while (level + 1 < m_levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)) {
+            level++;
+        }
+
+        const Level& texels = m_levels[level];
+
+        uint32_t texel_x1 = std::min(x1 >> level, texels.width - 1);
+        uint32_t texel_y1 = std::min(y1 >> level, texels.height - 1);
+
+        for (uint32_t y = std::min(y0 >> level, texel_y1); y <= texel_y1; y++) {
+            for (uint32_t x = std::min(x0 >> level, texel_x1); x <= texel_x1; x++) {
+                if (m_depth[texels.offset + y * texels.width + x] >= min_depth) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+private:
+    struct Level {
+        size_t offset;
+        uint32_t width;
+        uint32_t height;
+    };
+
+#ifdef MATHS_SSE2
+    static float horizontal_min(__m128 value) {
+        value = _mm_min_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(1, 0, 3, 2)));
+        value = _mm_min_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtss_f32(value);
+    }
+
+    static float horizontal_max(__m128 value) {
+        value = _mm_max_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(1, 0, 3, 2)));
+        value = _mm_max_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtss_f32(value);
+    }
+#endif
+
+    float get_screen_x(const OcclusionBufferVertex& vertex) const {
+        return (vertex.x / vertex.w * 0.5f + 0.5f) * static_cast<float>(m_width);
+    }
+
+    // Rows go from top to bottom.
+    float get_screen_y(const OcclusionBufferVertex& vertex) const {
+        return (0.5f - vertex.y / vertex.w * 0.5f) * static_cast<float>(m_height);
+    }
+
+    void transform_corners(const aabbox3& bounds, OcclusionBufferVertex (&corners)[8]) const {
+        const float (&m)[4][4] = m_view_projection.data;
+
+        OcclusionBufferVertex center{
+            bounds.center.x * m[0][0] + bounds.center.y * m[1][0] + bounds.center.z * m[2][0] + m[3][0],
+            bounds.center.x * m[0][1] + bounds.center.y * m[1][1] + bounds.center.z * m[2][1] + m[3][1],
+            bounds.center.x * m[0][2] + bounds.center.y * m[1][2] + bounds.center.z * m[2][2] + m[3][2],
+            bounds.center.x * m[0][3] + bounds.center.y * m[1][3] + bounds.center.z * m[2][3] + m[3][3]
+        };
+
+        for (uint32_t i = 0; i < 8; i++) {
+            float x = i & 1 ? bounds.extent.x : -bounds.extent.x;
+            float y = i & 2 ? bounds.extent.y : -bounds.extent.y;
+            float z = i & 4 ? bounds.extent.z : -bounds.extent.z;
+
+            corners[i] = OcclusionBufferVertex{
+                center.x + x * m[0][0] + y * m[1][0] + z * m[2][0],
+                center.y + x * m[0][1] + y * m[1][1] + z * m[2][1],
+                center.z + x * m[0][2] + y * m[1][2] + z * m[2][2],
+                center.w + x * m[0][3] + y * m[1][3] + z * m[2][3]
+            };
+        }
+    }
+
+    // Clips the face against the near plane, where clip space Z is zero. Returns the number of polygon vertices.
+    static uint32_t clip_near(const OcclusionBufferVertex (&corners)[8], const uint32_t (&face)[4], OcclusionBufferVertex (&polygon)[8]) {
+        uint32_t count = 0;
+
+        for (uint32_t i = 0; i < 4; i++) {
+            const OcclusionBufferVertex& current = corners[face[i]];
+            const OcclusionBufferVertex& next = corners[face[(i + 1) % 4]];
+
+            if (current.z >= 0.f) {
+                polygon[count++] = current;
+            }
+
+            if ((current.z >= 0.f) != (next.z >= 0.f)) {
+                float t = current.z / (current.z - next.z);
+                polygon[count++] = OcclusionBufferVertex{
+                    current.x + (next.x - current.x) * t,
+                    current.y + (next.y - current.y) * t,
+                    0.f,
+                    current.w + (next.w - current.w) * t
+                };
+            }
+        }
+
+        return count;
+    }
+
+    void rasterize(const OcclusionBufferVertex& vertex0, const OcclusionBufferVertex& vertex1, const OcclusionBufferVertex& vertex2) {
+        float x0 = get_screen_x(vertex0);
+        float y0 = get_screen_y(vertex0);
+        float z0 = vertex0.z / vertex0.w;
+        float x1 = get_screen_x(vertex1);
+        float y1 = get_screen_y(vertex1);
+        float z1 = vertex1.z / vertex1.w;
+        float x2 = get_screen_x(vertex2);
+        float y2 = get_screen_y(vertex2);
+        float z2 = vertex2.z / vertex2.w;
+
+        // Back faces have negative area.
+        float area = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+        if (!(area > 0.f)) {
+            return;
+        }
+
+        float min_x = std::max(std::min({ x0, x1, x2 }), 0.f);
+        float min_y = std::max(std::min({ y0, y1, y2 }), 0.f);
+        float max_x = std::min(std::max({ x0, x1, x2 }), static_cast<float>(m_width));
+        float max_y = std::min(std::max({ y0, y1, y2 }), static_cast<float>(m_height));
+
+        if (min_x >= max_x || min_y >= max_y) {
+            return;
+        }
+
+        // Edge functions are non-negative inside. They're offset by their largest change within half a pixel, so they're
+        // non-negative at a pixel center only when the whole pixel is inside.
+        float edge_a[3] = { y0 - y1, y1 - y2, y2 - y0 };
+        float edge_b[3] = { x1 - x0, x2 - x1, x0 - x2 };
+        float edge_c[3] = {
+            -(edge_a[0] * x0 + edge_b[0] * y0) - 0.5f * (std::abs(edge_a[0]) + std::abs(edge_b[0])),
+            -(edge_a[1] * x1 + edge_b[1] * y1) - 0.5f * (std::abs(edge_a[1]) + std::abs(edge_b[1])),
+            -(edge_a[2] * x2 + edge_b[2] * y2) - 0.5f * (std::abs(edge_a[2]) + std::abs(edge_b[2]))
+        };
+
+        // Depth is linear in screen space. It's offset to the farthest depth within half a pixel.
+        float depth_dx = ((z1 - z0) * (y2 - y0) - (z2 - z0) * (y1 - y0)) / area;
+        float depth_dy = ((z2 - z0) * (x1 - x0) - (z1 - z0) * (x2 - x0)) / area;
+        float depth_c = z0 - depth_dx * x0 - depth_dy * y0 + 0.5f * (std::abs(depth_dx) + std::abs(depth_dy));
+
+        uint32_t first_x = static_cast<uint32_t>(min_x) & ~3u;
+        uint32_t last_x = std::min(static_cast<uint32_t>(max_x), m_width - 1);
+        uint32_t first_y = static_cast<uint32_t>(min_y);
+        uint32_t last_y = std::min(static_cast<uint32_t>(max_y), m_height - 1);
+
+        for (uint32_t y = first_y; y <= last_y; y++) {
+            float center_y = static_cast<float>(y) + 0.5f;
+            float* row = m_depth.data() + static_cast<size_t>(y) * m_width;
+
+#ifdef MATHS_SSE2
+            __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+            for (uint32_t x = first_x; x <= last_x; x += 4) {
+                __m128 center_x = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+
+                __m128 edge0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge_a[0]), center_x), _mm_set1_ps(edge_b[0] * center_y + edge_c[0]));
+                __m128 edge1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge_a[1]), center_x), _mm_set1_ps(edge_b[1] * center_y + edge_c[1]));
+                __m128 edge2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge_a[2]), center_x), _mm_set1_ps(edge_b[2] * center_y + edge_c[2]));
+
+                __m128 zero = _mm_setzero_ps();
+                __m128 mask = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge0, zero), _mm_cmpge_ps(edge1, zero)), _mm_cmpge_ps(edge2, zero));
+
+                if (_mm_movemask_ps(mask) != 0) {
+                    __m128 depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depth_dx), center_x), _mm_set1_ps(depth_dy * center_y + depth_c));
+                    __m128 old_depth = _mm_loadu_ps(row + x);
+                    __m128 new_depth = _mm_min_ps(old_depth, depth);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, new_depth), _mm_andnot_ps(mask, old_depth)));
+                }
+            }
+#else
+            for (uint32_t x = first_x; x <= last_x; x++) {
+                float center_x = static_cast<float>(x) + 0.5f;
+
+                if (edge_a[0] * center_x + (edge_b[0] * center_y + edge_c[0]) >= 0.f &&
+                    edge_a[1] * center_x + (edge_b[1] * center_y + edge_c[1]) >= 0.f &&
+                    edge_a[2] * center_x + (edge_b[2] * center_y + edge_c[2]) >= 0.f)
+                {
+                    row[x] = std::min(row[x], depth_dx * center_x + (depth_dy * center_y + depth_c));
+                }
+            }
+#endif
+        }
+    }
+
+    std::vector<float, CountAllocator<float>> m_depth;
+    std::vector<Level> m_levels;
+    uint32_t m_width;
+    uint32_t m_height;
+    float4x4 m_view_projection;
+};
@@ -26,52 +26,90 @@ static float3 OCTREE_EXTENT_FACTORS[] = {
     float3{ -1.f, -1.f, -1.f },
 };
 
+constexpr uint32_t OCTREE_NO_CHILD = ~0u;
+
+// Combined with the index of the child nearest to the camera using XOR, gives children in approximate near to far order.
+constexpr uint32_t OCTREE_NEAR_TO_FAR[] = { 0, 1, 2, 4, 3, 5, 6, 7 };
+
+struct OctreeNode;
+
+// Nodes are allocated from the memory resource of their primitive list, so they must be freed there too.
+struct OctreeNodeDeleter {
+    void operator()(OctreeNode* node) const;
+};
+
 struct OctreeNode {
     OctreeNode(CountMemoryResource& memory_resource)
         : primitives(memory_resource)
     {
     }
 
-    std::unique_ptr<OctreeNode> children[8];
+    std::unique_ptr<OctreeNode, OctreeNodeDeleter> children[8];
     std::vector<AccelerationStructurePrimitive*, CountAllocator<AccelerationStructurePrimitive*>> primitives;
     aabbox3 bounds;
+    OctreeNode* parent = nullptr;
+
+    // Number of primitives in this node and all of its descendants. Only maintained in adaptive mode.
+    uint32_t count = 0;
+
+    // Squared length of the largest primitive extent in this node and its descendants. It's never decreased, so it's
+    // only an upper bound.
+    float max_extent_squared = 0.f;
+
+    // Adaptive mode only descends into nodes that were split. In fixed depth mode every node is subdivided.
+    bool subdivided = false;
+
+    // Bit `i` is set when child `i` may have bounds other than the ones derived from this node's bounds, e.g. the old
+    // root after growing, whose bounds may be off by rounding. Such children are tested with their own bounds.
+    uint8_t irregular_children = 0;
 };
 
+inline void OctreeNodeDeleter::operator()(OctreeNode* node) const {
+    CountMemoryResource& memory_resource = node->primitives.get_allocator().memory_resource;
+    node->~OctreeNode();
+    memory_resource.deallocate(node, sizeof(OctreeNode));
+}
+
 class OctreeAccelerationStructure : public AccelerationStructure, private OctreeNode {
 public:
-    OctreeAccelerationStructure(CountMemoryResource& memory_resource_, const float3& center, const float3& extent, uint32_t max_depth)
+    // When `split_threshold` is zero, the tree is subdivided geometrically down to `max_depth`. Otherwise a leaf holds up
+    // to `split_threshold` primitives before it's split, and a subtree holding `merge_threshold` primitives or less is
+    // merged back into a leaf. In the latter mode `max_depth` is only a safety cap.
+    //
+    // When a primitive doesn't fit the root, the tree can grow outwards up to `max_growth` times. Each time the root
+    // becomes a child of a new root twice its size, so the leaf size stays the same.
+    OctreeAccelerationStructure(CountMemoryResource& memory_resource_, const float3& center, const float3& extent, uint32_t max_depth, uint32_t split_threshold = 0, uint32_t merge_threshold = 0, uint32_t max_growth = 0)
         : OctreeNode(memory_resource_)
         , memory_resource(memory_resource_)
         , m_max_depth(max_depth)
+        , m_split_threshold(split_threshold)
+        , m_merge_threshold(merge_threshold)
+        , m_max_growth(max_growth)
+        , m_growth(0)
+        , m_version(0)
     {
         assert(extent.x > 0.f);
         assert(extent.y > 0.f);
         assert(extent.z > 0.f);
+        assert(split_threshold == 0 || merge_threshold < split_threshold);
 
         bounds.center = center;
         bounds.extent = extent;
+        subdivided = split_threshold == 0;
     }
 
     void add(AccelerationStructurePrimitive& primitive) override {
-        OctreeNode& node = find_node(primitive.get_bounds(), *this);
+        OctreeNode& node = find_node(primitive.get_bounds());
         assert(std::find(node.primitives.begin(), node.primitives.end(), &primitive) == node.primitives.end());
 
-        node.primitives.push_back(&primitive);
-
-        primitive.m_node = &node;
+        insert(node, primitive);
     }
 
     void remove(AccelerationStructurePrimitive& primitive) override {
         OctreeNode* node = static_cast<OctreeNode*>(primitive.m_node);
         assert(node != nullptr);
 
-        auto it = std::find(node->primitives.begin(), node->primitives.end(), &primitive);
-        assert(it != node->primitives.end());
-
-        *it = node->primitives.back();
-        node->primitives.pop_back();
-
-        primitive.m_node = nullptr;
+        erase(*node, primitive);
     }
 
     void update(AccelerationStructurePrimitive& primitive) override {
@@ -80,23 +118,131 @@ public:
 
         const aabbox3& bounds = primitive.get_bounds();
 
-        if (bounds.center.x - bounds.extent.x <  node->bounds.center.x - node->bounds.extent.x ||
-            bounds.center.y - bounds.extent.y <  node->bounds.center.y - node->bounds.extent.y ||
-            bounds.center.z - bounds.extent.z <  node->bounds.center.z - node->bounds.extent.z ||
-            bounds.center.x + bounds.extent.x >= node->bounds.center.x + node->bounds.extent.x ||
-            bounds.center.y + bounds.extent.y >= node->bounds.center.y + node->bounds.extent.y ||
-            bounds.center.z + bounds.extent.z >= node->bounds.center.z + node->bounds.extent.z)
-        {
-            auto it = std::find(node->primitives.begin(), node->primitives.end(), &primitive);
-            assert(it != node->primitives.end());
+        if (!contains(node->bounds, bounds)) {
+            erase(*node, primitive);
+            insert(find_node(bounds), primitive);
+        } else {
+            expand_max_extent(*node, bounds);
+        }
+    }
+
+    // Bounds of the node at the given depth that contains the point. A tile for that node must be created with these
+    // bounds, `max_depth` reduced by the depth and the same thresholds.
+    aabbox3 get_tile_bounds(const float3& point, uint32_t depth) const {
+        aabbox3 result = bounds;
+        for (uint32_t i = 0; i < depth; i++) {
+            result = get_child_bounds(result, get_tile_index(point, result));
+        }
+        return result;
+    }
+
+    // Moves the content of a tile, built separately (e.g. on a worker thread with its own memory resource), into this
+    // tree as the node at the tile's bounds. Nodes of the tile are moved as a whole, only primitives in the tile's root
+    // are touched. Primitives that were in the node before are inserted again. The tile is left empty.
+    //
+    // Moved nodes keep allocating from the tile's memory resource, so it must outlive them.
+    void attach(OctreeAccelerationStructure& tile) {
+        assert(m_split_threshold == tile.m_split_threshold && m_merge_threshold == tile.m_merge_threshold);
+        assert(tile.m_growth == 0);
 
-            *it = node->primitives.back();
-            node->primitives.pop_back();
+        OctreeNode& parent = get_tile_parent(tile.bounds);
+        uint32_t index = get_tile_index(tile.bounds.center, parent.bounds);
+        assert(get_depth(parent) + 1 + tile.m_max_depth <= m_max_depth);
 
-            OctreeNode& node = find_node(bounds, *this);
-            node.primitives.push_back(&primitive);
+        std::vector<AccelerationStructurePrimitive*> displaced;
 
-            primitive.m_node = &node;
+        if (parent.children[index]) {
+            std::unique_ptr<OctreeNode, OctreeNodeDeleter> node = take_child(parent, index);
+            gather_primitives(*node, displaced);
+        }
+
+        // The tile's root is a part of the tile object, so its content is moved to a new node.
+        OctreeNode& tile_root = tile;
+        std::unique_ptr<OctreeNode, OctreeNodeDeleter> node(new (tile.memory_resource.allocate(sizeof(OctreeNode))) OctreeNode(std::move(tile_root)));
+
+        tile_root.count = 0;
+        tile_root.max_extent_squared = 0.f;
+        tile.m_version++;
+
+        for (std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : node->children) {
+            if (child) {
+                child->parent = node.get();
+            }
+        }
+
+        // Primitives that don't fit the tile's bounds are in its root, they're inserted like any other.
+        for (size_t i = 0; i < node->primitives.size();) {
+            AccelerationStructurePrimitive* primitive = node->primitives[i];
+
+            if (contains(node->bounds, primitive->get_bounds())) {
+                primitive->m_node = node.get();
+                i++;
+            } else {
+                displaced.push_back(primitive);
+
+                node->primitives[i] = node->primitives.back();
+                node->primitives.pop_back();
+
+                if (m_split_threshold != 0) {
+                    node->count--;
+                }
+            }
+        }
+
+        put_child(parent, index, std::move(node));
+
+        for (AccelerationStructurePrimitive* primitive : displaced) {
+            insert(find_node(primitive->get_bounds()), *primitive);
+        }
+    }
+
+    // Moves the node at the tile's bounds with all of its descendants and primitives into the empty tile, which must be
+    // created like for `attach`. Primitives that straddle the tile's bounds are in ancestor nodes and stay in this tree.
+    void detach(OctreeAccelerationStructure& tile) {
+        assert(tile.primitives.empty() && std::none_of(std::begin(tile.children), std::end(tile.children), [](const auto& child) { return bool(child); }));
+
+        OctreeNode* parent = find_tile_parent(tile.bounds);
+        if (parent == nullptr) {
+            return;
+        }
+
+        uint32_t index = get_tile_index(tile.bounds.center, parent->bounds);
+        if (!parent->children[index]) {
+            return;
+        }
+
+        std::unique_ptr<OctreeNode, OctreeNodeDeleter> node = take_child(*parent, index);
+        assert(is_same_bounds(node->bounds, tile.bounds));
+
+        // Primitives of the moved node are copied to the tile's memory resource, children are moved as a whole.
+        OctreeNode& tile_root = tile;
+        tile_root = std::move(*node);
+        tile_root.parent = nullptr;
+        tile.m_version++;
+
+        for (AccelerationStructurePrimitive* primitive : tile_root.primitives) {
+            primitive->m_node = &tile_root;
+        }
+
+        for (std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : tile_root.children) {
+            if (child) {
+                child->parent = &tile_root;
+            }
+        }
+
+        if (m_split_threshold != 0) {
+            // Merge the topmost subtree that fell below the low-water mark.
+            OctreeNode* merge_node = nullptr;
+
+            for (OctreeNode* ancestor = parent; ancestor != nullptr; ancestor = ancestor->parent) {
+                if (ancestor->subdivided && ancestor->count <= m_merge_threshold) {
+                    merge_node = ancestor;
+                }
+            }
+
+            if (merge_node != nullptr) {
+                merge(*merge_node);
+            }
         }
     }
 
@@ -108,12 +254,83 @@ public:
         collect_primitives(*this, frustum, output);
     }
 
-private:
-    OctreeNode& find_node(const aabbox3& bounds, OctreeNode& node, uint32_t depth = 0) {
-        if (depth >= m_max_depth) {
-            return node;
+    // Nodes inside of the query output all of their primitives without testing them.
+    void query(const aabbox3& aabbox, PrimitiveBitset& output) const override {
+        collect_ids(*this, aabbox, output);
+    }
+
+    void query(const frustum& frustum, PrimitiveBitset& output) const override {
+        collect_ids(*this, frustum, output);
+    }
+
+    void query(const aabbox3& aabbox, std::vector<uint32_t>& output) const override {
+        collect_ids(*this, aabbox, output);
+    }
+
+    void query(const frustum& frustum, std::vector<uint32_t>& output) const override {
+        collect_ids(*this, frustum, output);
+    }
+
+    // Each node is visited once with the queries that intersect it.
+    void query(const aabbox3* aabboxes, size_t count, std::vector<AccelerationStructurePrimitive*>* outputs) const override {
+        collect_primitives(aabboxes, count, outputs);
+    }
+
+    void query(const frustum* frustums, size_t count, std::vector<AccelerationStructurePrimitive*>* outputs) const override {
+        collect_primitives(frustums, count, outputs);
+    }
+
+    // Children are culled by the bounds of the sweep first, then by the sweep itself, which skips children that only
+    // the corners of the sweep's bounds reach when the box moves diagonally.
+    void query(const aabbox3& aabbox, const float3& displacement, std::vector<AccelerationStructureImpact>& output) const override {
+        collect_impacts(*this, aabbox, displacement, get_swept_bounds(aabbox, displacement), output);
+    }
+
+    // Nodes behind occluders are skipped along with their primitives.
+    void query(const frustum& frustum, const OcclusionBuffer& occlusion_buffer, std::vector<AccelerationStructurePrimitive*>& output) const override {
+        collect_primitives(*this, frustum, occlusion_buffer, output);
+    }
+
+    // Nodes whose largest primitive would project smaller than `min_size` from the node's distance are skipped, children
+    // are visited from near to far.
+    void query(const frustum& frustum, const float3& camera_position, float projection_scale, float min_size, std::vector<AccelerationStructurePrimitive*>& output) const override {
+        size_t first = output.size();
+        collect_primitives(*this, frustum, camera_position, projection_scale, min_size, output);
+        sort_front_to_back(output, first, camera_position);
+    }
+
+    void query(const frustum& frustum, FrustumCullingContext& context, std::vector<AccelerationStructurePrimitive*>& added, std::vector<AccelerationStructurePrimitive*>& removed) const override {
+        context.begin(this, m_version, frustum);
+
+        // A primitive in a node outside of the frustum is outside too, so moved primitives are resolved upfront and
+        // nodes that keep their classification can be skipped regardless of what moved in or out of them.
+        context.apply_notifications([&frustum](const AccelerationStructurePrimitive& primitive) { return intersect(primitive.get_bounds(), frustum); }, added, removed);
+
+        // The root is never skipped, it holds primitives that don't fit its bounds.
+        for (AccelerationStructurePrimitive* primitive : primitives) {
+            context.update_visibility(primitive, intersect(primitive->get_bounds(), frustum), added, removed);
         }
 
+        for (const std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : children) {
+            if (child) {
+                collect_changes(*child, frustum, context, FRUSTUM_CULLING_UNKNOWN, added, removed);
+            }
+        }
+
+        context.end(frustum);
+    }
+
+private:
+    static bool contains(const aabbox3& node_bounds, const aabbox3& bounds) {
+        return bounds.center.x - bounds.extent.x >= node_bounds.center.x - node_bounds.extent.x &&
+               bounds.center.y - bounds.extent.y >= node_bounds.center.y - node_bounds.extent.y &&
+               bounds.center.z - bounds.extent.z >= node_bounds.center.z - node_bounds.extent.z &&
+               bounds.center.x + bounds.extent.x <  node_bounds.center.x + node_bounds.extent.x &&
+               bounds.center.y + bounds.extent.y <  node_bounds.center.y + node_bounds.extent.y &&
+               bounds.center.z + bounds.extent.z <  node_bounds.center.z + node_bounds.extent.z;
+    }
+
+    static uint32_t find_child_index(const aabbox3& bounds, const OctreeNode& node) {
         uint32_t index = 0;
 
         if (bounds.center.x - bounds.extent.x >= node.bounds.center.x) {
@@ -121,7 +338,7 @@ private:
         } else if (bounds.center.x + bounds.extent.x < node.bounds.center.x) {
             index |= OCTREE_NEGATIVE_X;
         } else {
-            return node;
+            return OCTREE_NO_CHILD;
         }
 
         if (bounds.center.y - bounds.extent.y >= node.bounds.center.y) {
@@ -129,7 +346,7 @@ private:
         } else if (bounds.center.y + bounds.extent.y < node.bounds.center.y) {
             index |= OCTREE_NEGATIVE_Y;
         } else {
-            return node;
+            return OCTREE_NO_CHILD;
         }
 
         if (bounds.center.z - bounds.extent.z >= node.bounds.center.z) {
@@ -137,27 +354,364 @@ private:
         } else if (bounds.center.z + bounds.extent.z < node.bounds.center.z) {
             index |= OCTREE_NEGATIVE_Z;
         } else {
+            return OCTREE_NO_CHILD;
+        }
+
+        return index;
+    }
+
+    OctreeNode& find_node(const aabbox3& bounds) {
+        while (m_growth < m_max_growth && !contains(this->bounds, bounds)) {
+            grow(bounds);
+        }
+
+        // Primitives that don't fit the root can't be put in any child node.
+        return contains(this->bounds, bounds) ? find_node(bounds, *this) : *this;
+    }
+
+    OctreeNode& find_node(const aabbox3& bounds, OctreeNode& node, uint32_t depth = 0) {
+        if (depth >= m_max_depth || !node.subdivided) {
+            return node;
+        }
+
+        uint32_t index = find_child_index(bounds, node);
+        if (index == OCTREE_NO_CHILD) {
             return node;
         }
 
-        std::unique_ptr<OctreeNode>& child = node.children[index];
+        return find_node(bounds, get_child(node, index), depth + 1);
+    }
+
+    static aabbox3 get_child_bounds(const aabbox3& bounds, uint32_t index) {
+        float extent_x = bounds.extent.x / 2.f;
+        float extent_y = bounds.extent.y / 2.f;
+        float extent_z = bounds.extent.z / 2.f;
+
+        float center_x = bounds.center.x + OCTREE_EXTENT_FACTORS[index].x * extent_x;
+        float center_y = bounds.center.y + OCTREE_EXTENT_FACTORS[index].y * extent_y;
+        float center_z = bounds.center.z + OCTREE_EXTENT_FACTORS[index].z * extent_z;
+
+        return aabbox3{
+            float3{ center_x, center_y, center_z },
+            float3{ extent_x, extent_y, extent_z }
+        };
+    }
+
+    // Children bounds in structure of arrays layout, children 0-3 in the first one and 4-7 in the second one.
+    static void get_child_bounds(const aabbox3& bounds, aabbox3x4 (&result)[2]) {
+        for (uint32_t i = 0; i < 8; i++) {
+            set_aabbox(result[i / 4], i % 4, get_child_bounds(bounds, i));
+        }
+    }
+
+    // Bit `i` is set when child `i` exists.
+    static uint32_t get_child_mask(const OctreeNode& node) {
+        uint32_t result = 0;
+        for (uint32_t i = 0; i < 8; i++) {
+            result |= static_cast<uint32_t>(node.children[i] != nullptr) << i;
+        }
+        return result;
+    }
+
+    // Bit `i` is set when child `i` exists and intersects the query. Children bounds are derived from the node's bounds
+    // and tested all at once, without touching the children themselves.
+    template <typename Bounds>
+    static uint32_t intersect_children(const OctreeNode& node, const Bounds& bounds) {
+        uint32_t mask = get_child_mask(node);
+        if (mask == 0) {
+            return 0;
+        }
+
+        aabbox3x4 child_bounds[2];
+        get_child_bounds(node.bounds, child_bounds);
+
+        uint32_t result = mask & ~node.irregular_children & (intersect(child_bounds[0], bounds) | intersect(child_bounds[1], bounds) << 4);
+
+        uint32_t irregular = mask & node.irregular_children;
+        for (uint32_t index = 0; irregular >> index != 0; index++) {
+            if (((irregular >> index) & 1) && intersect(node.children[index]->bounds, bounds)) {
+                result |= 1 << index;
+            }
+        }
+
+        return result;
+    }
+
+    OctreeNode& get_child(OctreeNode& node, uint32_t index) {
+        std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child = node.children[index];
         if (!child) {
-            float extent_x = node.bounds.extent.x / 2.f;
-            float extent_y = node.bounds.extent.y / 2.f;
-            float extent_z = node.bounds.extent.z / 2.f;
+            child = std::unique_ptr<OctreeNode, OctreeNodeDeleter>(new (memory_resource.allocate(sizeof(OctreeNode))) OctreeNode(memory_resource));
+            child->bounds = get_child_bounds(node.bounds, index);
+            child->parent = &node;
+            child->subdivided = m_split_threshold == 0;
+        }
+        return *child;
+    }
 
-            float center_x = node.bounds.center.x + OCTREE_EXTENT_FACTORS[index].x * extent_x;
-            float center_y = node.bounds.center.y + OCTREE_EXTENT_FACTORS[index].y * extent_y;
-            float center_z = node.bounds.center.z + OCTREE_EXTENT_FACTORS[index].z * extent_z;
+    void insert(OctreeNode& node, AccelerationStructurePrimitive& primitive) {
+        node.primitives.push_back(&primitive);
+
+        primitive.m_node = &node;
+
+        expand_max_extent(node, primitive.get_bounds());
+
+        if (m_split_threshold != 0) {
+            for (OctreeNode* ancestor = &node; ancestor != nullptr; ancestor = ancestor->parent) {
+                ancestor->count++;
+            }
 
-            child = std::unique_ptr<OctreeNode>(new (memory_resource.allocate(sizeof(OctreeNode))) OctreeNode(memory_resource));
-            child->bounds = aabbox3{
-                float3{ center_x, center_y, center_z },
-                float3{ extent_x, extent_y, extent_z }
-            };
+            if (!node.subdivided && node.primitives.size() > m_split_threshold) {
+                uint32_t depth = get_depth(node);
+                if (depth < m_max_depth) {
+                    split(node, depth);
+                }
+            }
         }
+    }
+
+    void erase(OctreeNode& node, AccelerationStructurePrimitive& primitive) {
+        auto it = std::find(node.primitives.begin(), node.primitives.end(), &primitive);
+        assert(it != node.primitives.end());
 
-        return find_node(bounds, *child, depth + 1);
+        *it = node.primitives.back();
+        node.primitives.pop_back();
+
+        primitive.m_node = nullptr;
+
+        if (m_split_threshold != 0) {
+            // Merge the topmost subtree that fell below the low-water mark.
+            OctreeNode* merge_node = nullptr;
+
+            for (OctreeNode* ancestor = &node; ancestor != nullptr; ancestor = ancestor->parent) {
+                assert(ancestor->count > 0);
+                ancestor->count--;
+
+                if (ancestor->subdivided && ancestor->count <= m_merge_threshold) {
+                    merge_node = ancestor;
+                }
+            }
+
+            if (merge_node != nullptr) {
+                merge(*merge_node);
+            }
+        }
+    }
+
+    static void expand_max_extent(OctreeNode& node, const aabbox3& bounds) {
+        float extent_squared = dot(bounds.extent, bounds.extent);
+        for (OctreeNode* ancestor = &node; ancestor != nullptr && ancestor->max_extent_squared < extent_squared; ancestor = ancestor->parent) {
+            ancestor->max_extent_squared = extent_squared;
+        }
+    }
+
+    uint32_t get_depth(const OctreeNode& node) const {
+        uint32_t depth = 0;
+        for (const OctreeNode* ancestor = node.parent; ancestor != nullptr; ancestor = ancestor->parent) {
+            depth++;
+        }
+        return depth;
+    }
+
+    void split(OctreeNode& node, uint32_t depth) {
+        assert(!node.subdivided);
+
+        node.subdivided = true;
+
+        // Primitives that straddle the node's center stay in the node, so do primitives of the root that don't fit it.
+        for (size_t i = 0; i < node.primitives.size();) {
+            AccelerationStructurePrimitive* primitive = node.primitives[i];
+
+            uint32_t index = contains(node.bounds, primitive->get_bounds()) ? find_child_index(primitive->get_bounds(), node) : OCTREE_NO_CHILD;
+            if (index != OCTREE_NO_CHILD) {
+                OctreeNode& child = get_child(node, index);
+                child.primitives.push_back(primitive);
+                child.count++;
+
+                primitive->m_node = &child;
+
+                expand_max_extent(child, primitive->get_bounds());
+
+                node.primitives[i] = node.primitives.back();
+                node.primitives.pop_back();
+            } else {
+                i++;
+            }
+        }
+
+        if (depth + 1 < m_max_depth) {
+            for (std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : node.children) {
+                if (child && child->primitives.size() > m_split_threshold) {
+                    split(*child, depth + 1);
+                }
+            }
+        }
+    }
+
+    void grow(const aabbox3& bounds) {
+        // The current root becomes the child on the opposite side from the primitive.
+        uint32_t index = 0;
+        index |= bounds.center.x < this->bounds.center.x ? OCTREE_POSITIVE_X : OCTREE_NEGATIVE_X;
+        index |= bounds.center.y < this->bounds.center.y ? OCTREE_POSITIVE_Y : OCTREE_NEGATIVE_Y;
+        index |= bounds.center.z < this->bounds.center.z ? OCTREE_POSITIVE_Z : OCTREE_NEGATIVE_Z;
+
+        std::unique_ptr<OctreeNode, OctreeNodeDeleter> child(new (memory_resource.allocate(sizeof(OctreeNode))) OctreeNode(memory_resource));
+        child->bounds = this->bounds;
+        child->parent = this;
+        child->subdivided = subdivided;
+        child->max_extent_squared = max_extent_squared;
+        child->irregular_children = irregular_children;
+
+        for (size_t i = 0; i < 8; i++) {
+            if (children[i]) {
+                children[i]->parent = child.get();
+                child->count += children[i]->count;
+                child->children[i] = std::move(children[i]);
+            }
+        }
+
+        this->bounds.center.x -= OCTREE_EXTENT_FACTORS[index].x * this->bounds.extent.x;
+        this->bounds.center.y -= OCTREE_EXTENT_FACTORS[index].y * this->bounds.extent.y;
+        this->bounds.center.z -= OCTREE_EXTENT_FACTORS[index].z * this->bounds.extent.z;
+        this->bounds.extent.x *= 2.f;
+        this->bounds.extent.y *= 2.f;
+        this->bounds.extent.z *= 2.f;
+
+        children[index] = std::move(child);
+        subdivided = true;
+        irregular_children = static_cast<uint8_t>(1 << index);
+
+        m_max_depth++;
+        m_growth++;
+        m_version++;
+
+        // Primitives that straddled the old center or didn't fit the old root may go deeper now.
+        std::vector<AccelerationStructurePrimitive*, CountAllocator<AccelerationStructurePrimitive*>> root_primitives(memory_resource);
+        root_primitives.swap(primitives);
+
+        if (m_split_threshold != 0) {
+            count -= static_cast<uint32_t>(root_primitives.size());
+        }
+
+        for (AccelerationStructurePrimitive* primitive : root_primitives) {
+            const aabbox3& primitive_bounds = primitive->get_bounds();
+            insert(contains(this->bounds, primitive_bounds) ? find_node(primitive_bounds, *this) : *this, *primitive);
+        }
+    }
+
+    void merge(OctreeNode& node) {
+        assert(node.subdivided);
+
+        for (std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : node.children) {
+            if (child) {
+                gather_primitives(*child, node);
+                child.reset();
+            }
+        }
+
+        node.subdivided = false;
+
+        m_version++;
+    }
+
+    void gather_primitives(OctreeNode& source, OctreeNode& destination) {
+        for (AccelerationStructurePrimitive* primitive : source.primitives) {
+            destination.primitives.push_back(primitive);
+            primitive->m_node = &destination;
+        }
+
+        for (std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : source.children) {
+            if (child) {
+                gather_primitives(*child, destination);
+            }
+        }
+    }
+
+    void gather_primitives(const OctreeNode& source, std::vector<AccelerationStructurePrimitive*>& output) {
+        output.insert(output.end(), source.primitives.begin(), source.primitives.end());
+
+        for (const std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : source.children) {
+            if (child) {
+                gather_primitives(*child, output);
+            }
+        }
+    }
+
+    // Child bounds are computed the same way everywhere, so the bounds of the same node are exactly equal.
+    static bool is_same_bounds(const aabbox3& lhs, const aabbox3& rhs) {
+        return lhs.center.x == rhs.center.x && lhs.center.y == rhs.center.y && lhs.center.z == rhs.center.z &&
+               lhs.extent.x == rhs.extent.x && lhs.extent.y == rhs.extent.y && lhs.extent.z == rhs.extent.z;
+    }
+
+    // Index of the child that contains the point, points on the center belong to the positive side.
+    static uint32_t get_tile_index(const float3& point, const aabbox3& bounds) {
+        uint32_t index = 0;
+        index |= point.x >= bounds.center.x ? OCTREE_POSITIVE_X : OCTREE_NEGATIVE_X;
+        index |= point.y >= bounds.center.y ? OCTREE_POSITIVE_Y : OCTREE_NEGATIVE_Y;
+        index |= point.z >= bounds.center.z ? OCTREE_POSITIVE_Z : OCTREE_NEGATIVE_Z;
+        return index;
+    }
+
+    // Creates nodes down to the parent of the tile's node. They're all subdivided, so primitives can reach the tile.
+    OctreeNode& get_tile_parent(const aabbox3& tile_bounds) {
+        assert(tile_bounds.extent.x < bounds.extent.x);
+
+        OctreeNode* node = this;
+        node->subdivided = true;
+
+        while (node->bounds.extent.x / 2.f > tile_bounds.extent.x) {
+            node = &get_child(*node, get_tile_index(tile_bounds.center, node->bounds));
+            node->subdivided = true;
+        }
+
+        assert(is_same_bounds(get_child_bounds(node->bounds, get_tile_index(tile_bounds.center, node->bounds)), tile_bounds));
+        return *node;
+    }
+
+    OctreeNode* find_tile_parent(const aabbox3& tile_bounds) {
+        OctreeNode* node = this;
+
+        while (node != nullptr && node->bounds.extent.x / 2.f > tile_bounds.extent.x) {
+            node = node->children[get_tile_index(tile_bounds.center, node->bounds)].get();
+        }
+
+        return node;
+    }
+
+    // Unlinks a subtree and removes its primitives from the ancestors' count. Doesn't merge the ancestors.
+    std::unique_ptr<OctreeNode, OctreeNodeDeleter> take_child(OctreeNode& node, uint32_t index) {
+        std::unique_ptr<OctreeNode, OctreeNodeDeleter> child = std::move(node.children[index]);
+        child->parent = nullptr;
+
+        if (m_split_threshold != 0) {
+            for (OctreeNode* ancestor = &node; ancestor != nullptr; ancestor = ancestor->parent) {
+                assert(ancestor->count >= child->count);
+                ancestor->count -= child->count;
+            }
+        }
+
+        m_version++;
+
+        return child;
+    }
+
+    void put_child(OctreeNode& node, uint32_t index, std::unique_ptr<OctreeNode, OctreeNodeDeleter> child) {
+        assert(!node.children[index]);
+
+        for (OctreeNode* ancestor = &node; ancestor != nullptr; ancestor = ancestor->parent) {
+            if (m_split_threshold != 0) {
+                ancestor->count += child->count;
+            }
+            ancestor->max_extent_squared = std::max(ancestor->max_extent_squared, child->max_extent_squared);
+        }
+
+        if (!is_same_bounds(child->bounds, get_child_bounds(node.bounds, index))) {
+            node.irregular_children |= 1 << index;
+        }
+
+        child->parent = &node;
+        node.children[index] = std::move(child);
+
+        m_version++;
     }
 
     template <typename Bounds>
@@ -170,13 +724,252 @@ private:
             }
         }
 
-        for (const std::unique_ptr<OctreeNode>& child : node.children) {
-            if (child && intersect(child->bounds, bounds)) {
-                collect_primitives(*child, bounds, output);
+        uint32_t mask = intersect_children(node, bounds);
+        for (uint32_t index = 0; mask >> index != 0; index++) {
+            if ((mask >> index) & 1) {
+                collect_primitives(*node.children[index], bounds, output);
+            }
+        }
+    }
+
+    static void push(PrimitiveBitset& output, const AccelerationStructurePrimitive& primitive) {
+        output.set(primitive.get_id());
+    }
+
+    static void push(std::vector<uint32_t>& output, const AccelerationStructurePrimitive& primitive) {
+        output.push_back(primitive.get_id());
+    }
+
+    // Primitives of a node are within its bounds, except for the root which also holds primitives that don't fit.
+    static bool is_inside(const aabbox3& node_bounds, const aabbox3& aabbox) {
+        return contains(aabbox, node_bounds);
+    }
+
+    static bool is_inside(const aabbox3& node_bounds, const frustum& frustum) {
+        return ::contains(frustum, node_bounds);
+    }
+
+    template <typename Bounds, typename Output>
+    void collect_ids(const OctreeNode& node, const Bounds& bounds, Output& output) const {
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            if (intersect(primitive->get_bounds(), bounds)) {
+                push(output, *primitive);
+            }
+        }
+
+        uint32_t mask = intersect_children(node, bounds);
+        for (uint32_t index = 0; mask >> index != 0; index++) {
+            if ((mask >> index) & 1) {
+                const OctreeNode& child = *node.children[index];
+                if (is_inside(child.bounds, bounds)) {
+                    collect_all_ids(child, output);
+                } else {
+                    collect_ids(child, bounds, output);
+                }
+            }
+        }
+    }
+
+    // Ids within a subtree are scattered, so bits are set one at a time rather than in ranges like the compact octree.
+    template <typename Output>
+    void collect_all_ids(const OctreeNode& node, Output& output) const {
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            push(output, *primitive);
+        }
+
+        for (const std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : node.children) {
+            if (child) {
+                collect_all_ids(*child, output);
             }
         }
     }
 
+    template <typename Bounds>
+    void collect_primitives(const Bounds* bounds, size_t count, std::vector<AccelerationStructurePrimitive*>* outputs) const {
+        std::vector<uint32_t> indices(count);
+        for (size_t i = 0; i < count; i++) {
+            indices[i] = static_cast<uint32_t>(i);
+        }
+
+        collect_primitives(*this, bounds, indices, 0, outputs);
+    }
+
+    // Queries of a node are `indices` starting at `first`. Queries of its children are appended after them while the
+    // child is visited.
+    template <typename Bounds>
+    void collect_primitives(const OctreeNode& node, const Bounds* bounds, std::vector<uint32_t>& indices, size_t first, std::vector<AccelerationStructurePrimitive*>* outputs) const {
+        size_t last = indices.size();
+
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            for (size_t i = first; i < last; i++) {
+                if (intersect(primitive->get_bounds(), bounds[indices[i]])) {
+                    outputs[indices[i]].push_back(primitive);
+                }
+            }
+        }
+
+        for (const std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : node.children) {
+            if (child) {
+                for (size_t i = first; i < last; i++) {
+                    if (intersect(child->bounds, bounds[indices[i]])) {
+                        indices.push_back(indices[i]);
+                    }
+                }
+
+                if (indices.size() > last) {
+                    collect_primitives(*child, bounds, indices, last, outputs);
+                    indices.resize(last);
+                }
+            }
+        }
+    }
+
+    void collect_impacts(const OctreeNode& node, const aabbox3& aabbox, const float3& displacement, const aabbox3& swept_bounds, std::vector<AccelerationStructureImpact>& output) const {
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            float time;
+            if (intersect(primitive->get_bounds(), swept_bounds) && intersect(aabbox, displacement, primitive->get_bounds(), time)) {
+                output.push_back(AccelerationStructureImpact{ primitive, time });
+            }
+        }
+
+        uint32_t mask = intersect_children(node, swept_bounds);
+        for (uint32_t index = 0; mask >> index != 0; index++) {
+            float time;
+            if (((mask >> index) & 1) && intersect(aabbox, displacement, node.children[index]->bounds, time)) {
+                collect_impacts(*node.children[index], aabbox, displacement, swept_bounds, output);
+            }
+        }
+    }
+
+    void collect_primitives(const OctreeNode& node, const frustum& frustum, const OcclusionBuffer& occlusion_buffer, std::vector<AccelerationStructurePrimitive*>& output) const {
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            if (intersect(primitive->get_bounds(), frustum) && !occlusion_buffer.is_occluded(primitive->get_bounds())) {
+                output.push_back(primitive);
+            }
+        }
+
+        uint32_t mask = intersect_children(node, frustum);
+        for (uint32_t index = 0; mask >> index != 0; index++) {
+            if (((mask >> index) & 1) && !occlusion_buffer.is_occluded(node.children[index]->bounds)) {
+                collect_primitives(*node.children[index], frustum, occlusion_buffer, output);
+            }
+        }
+    }
+
+    void collect_primitives(const OctreeNode& node, const frustum& frustum, const float3& camera_position, float projection_scale, float min_size, std::vector<AccelerationStructurePrimitive*>& output) const {
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            if (intersect(primitive->get_bounds(), frustum) && !is_smaller(primitive->get_bounds(), camera_position, projection_scale, min_size)) {
+                output.push_back(primitive);
+            }
+        }
+
+        uint32_t nearest = 0;
+        nearest |= camera_position.x >= node.bounds.center.x ? OCTREE_POSITIVE_X : OCTREE_NEGATIVE_X;
+        nearest |= camera_position.y >= node.bounds.center.y ? OCTREE_POSITIVE_Y : OCTREE_NEGATIVE_Y;
+        nearest |= camera_position.z >= node.bounds.center.z ? OCTREE_POSITIVE_Z : OCTREE_NEGATIVE_Z;
+
+        uint32_t mask = intersect_children(node, frustum);
+
+        // Primitives of a child are no closer than the child and no larger than its largest primitive.
+        for (uint32_t order : OCTREE_NEAR_TO_FAR) {
+            const std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child = node.children[nearest ^ order];
+            if (((mask >> (nearest ^ order)) & 1) && !is_smaller(child->max_extent_squared, distance_squared(camera_position, child->bounds), projection_scale, min_size)) {
+                collect_primitives(*child, frustum, camera_position, projection_scale, min_size, output);
+            }
+        }
+    }
+
+    // `prior` is the node's classification against the previous frustum when it's known from an ancestor.
+    void collect_changes(const OctreeNode& node, const frustum& frustum, FrustumCullingContext& context, uint8_t prior, std::vector<AccelerationStructurePrimitive*>& added, std::vector<AccelerationStructurePrimitive*>& removed) const {
+        FrustumCullingNodeState& state = context.get_node_state(&node);
+
+        if (context.is_valid(state)) {
+            prior = state.classification;
+
+            if (prior != FRUSTUM_CULLING_PARTIAL && context.is_unchanged(node.bounds, state)) {
+                return;
+            }
+        }
+
+        context.classify(node.bounds, frustum, state);
+
+        if (state.classification == FRUSTUM_CULLING_OUTSIDE) {
+            if (prior != FRUSTUM_CULLING_OUTSIDE) {
+                erase_visible(node, context, removed);
+            }
+        } else if (state.classification == FRUSTUM_CULLING_INSIDE) {
+            if (prior != FRUSTUM_CULLING_INSIDE) {
+                insert_visible(node, context, added);
+            }
+        } else {
+            for (AccelerationStructurePrimitive* primitive : node.primitives) {
+                bool is_visible = intersect(primitive->get_bounds(), frustum);
+
+                // Moved primitives are up to date already, so the classification tells whether the others were visible.
+                if (prior == FRUSTUM_CULLING_OUTSIDE ? is_visible : prior == FRUSTUM_CULLING_INSIDE ? !is_visible : true) {
+                    context.update_visibility(primitive, is_visible, added, removed);
+                }
+            }
+
+            // Children that were skipped or not visited last time inherit the classification of this node.
+            uint8_t child_prior = prior == FRUSTUM_CULLING_PARTIAL ? FRUSTUM_CULLING_UNKNOWN : prior;
+
+            for (const std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : node.children) {
+                if (child) {
+                    collect_changes(*child, frustum, context, child_prior, added, removed);
+                }
+            }
+        }
+    }
+
+    // Children that were inside of the previous frustum too don't need to be visited.
+    void insert_visible(const OctreeNode& node, FrustumCullingContext& context, std::vector<AccelerationStructurePrimitive*>& added) const {
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            if (context.m_visible.insert(primitive).second) {
+                added.push_back(primitive);
+            }
+        }
+
+        for (const std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : node.children) {
+            if (child && !has_classification(*child, context, FRUSTUM_CULLING_INSIDE)) {
+                insert_visible(*child, context, added);
+            }
+        }
+    }
+
+    // Children that were outside of the previous frustum too don't need to be visited.
+    void erase_visible(const OctreeNode& node, FrustumCullingContext& context, std::vector<AccelerationStructurePrimitive*>& removed) const {
+        if (context.m_visible.empty()) {
+            return;
+        }
+
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            if (context.m_visible.erase(primitive) != 0) {
+                removed.push_back(primitive);
+            }
+        }
+
+        for (const std::unique_ptr<OctreeNode, OctreeNodeDeleter>& child : node.children) {
+            if (child && !has_classification(*child, context, FRUSTUM_CULLING_OUTSIDE)) {
+                erase_visible(*child, context, removed);
+            }
+        }
+    }
+
+    bool has_classification(const OctreeNode& node, FrustumCullingContext& context, uint8_t classification) const {
+        auto it = context.m_nodes.find(&node);
+        return it != context.m_nodes.end() && context.is_valid(it->second) && it->second.classification == classification;
+    }
+
     CountMemoryResource& memory_resource;
     uint32_t m_max_depth;
+    uint32_t m_split_threshold;
+    uint32_t m_merge_threshold;
+    uint32_t m_max_growth;
+    uint32_t m_growth;
+
+    // Incremented whenever nodes are deleted or resized, so culling contexts don't reuse their classification.
+    uint32_t m_version;
+
+    friend class CompactOctree;
 };
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+// Set of primitive ids, one bit per id. Must be resized to cover all ids before it's written to.
+class PrimitiveBitset {
+public:
+    void resize(size_t size) {
+        m_words.resize((size + 63) / 64, 0);
+        m_size = size;
+
+        // Bits past the size must stay clear, so the set operations don't need to mask them.
+        if (size % 64 != 0) {
+            m_words.back() &= (uint64_t(1) << (size % 64)) - 1;
+        }
+    }
+
+    size_t get_size() const {
+        return m_size;
+    }
+
+    void clear() {
+        std::fill(m_words.begin(), m_words.end(), 0);
+    }
+
+    void set(uint32_t id) {
+        assert(id < m_size);
+        m_words[id / 64] |= uint64_t(1) << (id % 64);
+    }
+
+    // Sets ids from `first` to `last` exclusive, whole words at once.
+    void set_range(uint32_t first, uint32_t last) {
+        assert(first <= last && last <= m_size);
+
+        if (first == last) {
+            return;
+        }
+
+        size_t first_word = first / 64;
+        size_t last_word = (last - 1) / 64;
+
+        uint64_t first_mask = ~uint64_t(0) << (first % 64);
+        uint64_t last_mask = ~uint64_t(0) >> (63 - (last - 1) % 64);
+
+        if (first_word == last_word) {
+            m_words[first_word] |= first_mask & last_mask;
+        } else {
+            m_words[first_word] |= first_mask;
+            std::fill(m_words.begin() + first_word + 1, m_words.begin() + last_word, ~uint64_t(0));
+            m_words[last_word] |= last_mask;
+        }
+    }
+
+    bool test(uint32_t id) const {
+        assert(id < m_size);
+        return (m_words[id / 64] >> (id % 64)) & 1;
+    }
+
+    size_t count() const {
+        size_t result = 0;
+        for (uint64_t word : m_words) {
+            result += std::bitset<64>(word).count();
+        }
+        return result;
+    }
+
+    // Set operations require bitsets of the same size.
+    PrimitiveBitset& operator|=(const PrimitiveBitset& other) {
+        assert(m_size == other.m_size);
+        for (size_t i = 0; i < m_words.size(); i++) {
+            m_words[i] |= other.m_words[i];
+        }
+        return *this;
+    }
+
+    PrimitiveBitset& operator&=(const PrimitiveBitset& other) {
+        assert(m_size == other.m_size);
+        for (size_t i = 0; i < m_words.size(); i++) {
+            m_words[i] &= other.m_words[i];
+        }
+        return *this;
+    }
+
+    // Clears ids that are set in the other bitset, e.g. to find primitives that stopped being visible.
+    PrimitiveBitset& subtract(const PrimitiveBitset& other) {
+        assert(m_size == other.m_size);
+        for (size_t i = 0; i < m_words.size(); i++) {
+            m_words[i] &= ~other.m_words[i];
+        }
+        return *this;
+    }
+
+    bool operator==(const PrimitiveBitset& other) const {
+        return m_size == other.m_size && m_words == other.m_words;
+    }
+
+    bool operator!=(const PrimitiveBitset& other) const {
+        return !(*this == other);
+    }
+
+    // Appends set ids in increasing order.
+    void get_ids(std::vector<uint32_t>& output) const {
+        for (size_t i = 0; i < m_words.size(); i++) {
+            uint64_t word = m_words[i];
+            while (word != 0) {
+                // Number of trailing zeros is the number of bits set below the lowest set bit.
+                uint64_t lowest = word & (~word + 1);
+                output.push_back(static_cast<uint32_t>(i * 64 + std::bitset<64>(lowest - 1).count()));
+                word &= word - 1;
+            }
+        }
+    }
+
+private:
+    std::vector<uint64_t> m_words;
+    size_t m_size = 0;
+};
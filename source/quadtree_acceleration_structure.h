@@ -20,51 +20,88 @@ static float2 QUADTREE_EXTENT_FACTORS[] = {
     float2{ -1.f, -1.f },
 };
 
+constexpr uint32_t QUADTREE_NO_CHILD = ~0u;
+
+// Combined with the index of the child nearest to the camera using XOR, gives children in near to far order.
+constexpr uint32_t QUADTREE_NEAR_TO_FAR[] = { 0, 1, 2, 3 };
+
+struct QuadtreeNode;
+
+// Nodes are allocated from the memory resource of their primitive list, so they must be freed there too.
+struct QuadtreeNodeDeleter {
+    void operator()(QuadtreeNode* node) const;
+};
+
 struct QuadtreeNode {
     QuadtreeNode(CountMemoryResource& memory_resource)
         : primitives(memory_resource)
     {
     }
 
-    std::unique_ptr<QuadtreeNode> children[4];
+    std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter> children[4];
     std::vector<AccelerationStructurePrimitive*, CountAllocator<AccelerationStructurePrimitive*>> primitives;
     aabbox2 bounds;
+    QuadtreeNode* parent = nullptr;
+
+    // Number of primitives in this node and all of its descendants. Only maintained in adaptive mode.
+    uint32_t count = 0;
+
+    // Squared length of the largest primitive extent in this node and its descendants. It's never decreased, so it's
+    // only an upper bound.
+    float max_extent_squared = 0.f;
+
+    // Adaptive mode only descends into nodes that were split. In fixed depth mode every node is subdivided.
+    bool subdivided = false;
+
+    // Bit `i` is set when child `i` may have bounds other than the ones derived from this node's bounds, e.g. the old
+    // root after growing, whose bounds may be off by rounding. Such children are tested with their own bounds.
+    uint8_t irregular_children = 0;
 };
 
+inline void QuadtreeNodeDeleter::operator()(QuadtreeNode* node) const {
+    CountMemoryResource& memory_resource = node->primitives.get_allocator().memory_resource;
+    node->~QuadtreeNode();
+    memory_resource.deallocate(node, sizeof(QuadtreeNode));
+}
+
 class QuadtreeAccelerationStructure : public AccelerationStructure, private QuadtreeNode {
 public:
-    QuadtreeAccelerationStructure(CountMemoryResource& memory_resource_, const float2& center, const float2& extent, uint32_t max_depth)
+    // When `split_threshold` is zero, the tree is subdivided geometrically down to `max_depth`. Otherwise a leaf holds up
+    // to `split_threshold` primitives before it's split, and a subtree holding `merge_threshold` primitives or less is
+    // merged back into a leaf. In the latter mode `max_depth` is only a safety cap.
+    //
+    // When a primitive doesn't fit the root, the tree can grow outwards up to `max_growth` times. Each time the root
+    // becomes a child of a new root twice its size, so the leaf size stays the same.
+    QuadtreeAccelerationStructure(CountMemoryResource& memory_resource_, const float2& center, const float2& extent, uint32_t max_depth, uint32_t split_threshold = 0, uint32_t merge_threshold = 0, uint32_t max_growth = 0)
         : QuadtreeNode(memory_resource_)
         , memory_resource(memory_resource_)
         , m_max_depth(max_depth)
+        , m_split_threshold(split_threshold)
+        , m_merge_threshold(merge_threshold)
+        , m_max_growth(max_growth)
+        , m_growth(0)
     {
         assert(extent.x > 0.f);
         assert(extent.y > 0.f);
+        assert(split_threshold == 0 || merge_threshold < split_threshold);
 
         bounds.center = center;
         bounds.extent = extent;
+        subdivided = split_threshold == 0;
     }
 
     void add(AccelerationStructurePrimitive& primitive) override {
-        QuadtreeNode& node = find_node(primitive.get_bounds(), *this);
+        QuadtreeNode& node = find_node(primitive.get_bounds());
         assert(std::find(node.primitives.begin(), node.primitives.end(), &primitive) == node.primitives.end());
 
-        node.primitives.push_back(&primitive);
-
-        primitive.m_node = &node;
+        insert(node, primitive);
     }
 
     void remove(AccelerationStructurePrimitive& primitive) override {
         QuadtreeNode* node = static_cast<QuadtreeNode*>(primitive.m_node);
         assert(node != nullptr);
 
-        auto it = std::find(node->primitives.begin(), node->primitives.end(), &primitive);
-        assert(it != node->primitives.end());
-
-        *it = node->primitives.back();
-        node->primitives.pop_back();
-
-        primitive.m_node = nullptr;
+        erase(*node, primitive);
     }
 
     void update(AccelerationStructurePrimitive& primitive) override {
@@ -73,53 +110,228 @@ public:
 
         const aabbox3& bounds = primitive.get_bounds();
 
-        if (bounds.center.x - bounds.extent.x <  node->bounds.center.x - node->bounds.extent.x ||
-            bounds.center.z - bounds.extent.z <  node->bounds.center.y - node->bounds.extent.y ||
-            bounds.center.x + bounds.extent.x >= node->bounds.center.x + node->bounds.extent.x ||
-            bounds.center.z + bounds.extent.z >= node->bounds.center.y + node->bounds.extent.y)
-        {
-            auto it = std::find(node->primitives.begin(), node->primitives.end(), &primitive);
-            assert(it != node->primitives.end());
+        if (!contains(node->bounds, bounds)) {
+            erase(*node, primitive);
+            insert(find_node(bounds), primitive);
+        } else {
+            expand_max_extent(*node, bounds);
+        }
+    }
+
+    // Bounds of the node at the given depth that contains the point on the XZ plane. A tile for that node must be created
+    // with these bounds, `max_depth` reduced by the depth and the same thresholds.
+    aabbox2 get_tile_bounds(const float2& point, uint32_t depth) const {
+        aabbox2 result = bounds;
+        for (uint32_t i = 0; i < depth; i++) {
+            result = get_child_bounds(result, get_tile_index(point, result));
+        }
+        return result;
+    }
+
+    // Moves the content of a tile, built separately (e.g. on a worker thread with its own memory resource), into this
+    // tree as the node at the tile's bounds. Nodes of the tile are moved as a whole, only primitives in the tile's root
+    // are touched. Primitives that were in the node before are inserted again. The tile is left empty.
+    //
+    // Moved nodes keep allocating from the tile's memory resource, so it must outlive them.
+    void attach(QuadtreeAccelerationStructure& tile) {
+        assert(m_split_threshold == tile.m_split_threshold && m_merge_threshold == tile.m_merge_threshold);
+        assert(tile.m_growth == 0);
+
+        QuadtreeNode& parent = get_tile_parent(tile.bounds);
+        uint32_t index = get_tile_index(tile.bounds.center, parent.bounds);
+        assert(get_depth(parent) + 1 + tile.m_max_depth <= m_max_depth);
+
+        std::vector<AccelerationStructurePrimitive*> displaced;
+
+        if (parent.children[index]) {
+            std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter> node = take_child(parent, index);
+            gather_primitives(*node, displaced);
+        }
+
+        // The tile's root is a part of the tile object, so its content is moved to a new node.
+        QuadtreeNode& tile_root = tile;
+        std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter> node(new (tile.memory_resource.allocate(sizeof(QuadtreeNode))) QuadtreeNode(std::move(tile_root)));
+
+        tile_root.count = 0;
+        tile_root.max_extent_squared = 0.f;
+
+        for (std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>& child : node->children) {
+            if (child) {
+                child->parent = node.get();
+            }
+        }
+
+        // Primitives that don't fit the tile's bounds are in its root, they're inserted like any other.
+        for (size_t i = 0; i < node->primitives.size();) {
+            AccelerationStructurePrimitive* primitive = node->primitives[i];
+
+            if (contains(node->bounds, primitive->get_bounds())) {
+                primitive->m_node = node.get();
+                i++;
+            } else {
+                displaced.push_back(primitive);
 
-            *it = node->primitives.back();
-            node->primitives.pop_back();
+                node->primitives[i] = node->primitives.back();
+                node->primitives.pop_back();
 
-            QuadtreeNode& node = find_node(bounds, *this);
-            node.primitives.push_back(&primitive);
+                if (m_split_threshold != 0) {
+                    node->count--;
+                }
+            }
+        }
 
-            primitive.m_node = &node;
+        put_child(parent, index, std::move(node));
+
+        for (AccelerationStructurePrimitive* primitive : displaced) {
+            insert(find_node(primitive->get_bounds()), *primitive);
         }
     }
 
+    // Moves the node at the tile's bounds with all of its descendants and primitives into the empty tile, which must be
+    // created like for `attach`. Primitives that straddle the tile's bounds are in ancestor nodes and stay in this tree.
+    void detach(QuadtreeAccelerationStructure& tile) {
+        assert(tile.primitives.empty() && std::none_of(std::begin(tile.children), std::end(tile.children), [](const auto& child) { return bool(child); }));
+
+        QuadtreeNode* parent = find_tile_parent(tile.bounds);
+        if (parent == nullptr) {
+            return;
+        }
+
+        uint32_t index = get_tile_index(tile.bounds.center, parent->bounds);
+        if (!parent->children[index]) {
+            return;
+        }
+
+        std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter> node = take_child(*parent, index);
+        assert(is_same_bounds(node->bounds, tile.bounds));
+
+        // Primitives of the moved node are copied to the tile's memory resource, children are moved as a whole.
+        QuadtreeNode& tile_root = tile;
+        tile_root = std::move(*node);
+        tile_root.parent = nullptr;
+
+        for (AccelerationStructurePrimitive* primitive : tile_root.primitives) {
+            primitive->m_node = &tile_root;
+        }
+
+        for (std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>& child : tile_root.children) {
+            if (child) {
+                child->parent = &tile_root;
+            }
+        }
+
+        if (m_split_threshold != 0) {
+            // Merge the topmost subtree that fell below the low-water mark.
+            QuadtreeNode* merge_node = nullptr;
+
+            for (QuadtreeNode* ancestor = parent; ancestor != nullptr; ancestor = ancestor->parent) {
+                if (ancestor->subdivided && ancestor->count <= m_merge_threshold) {
+                    merge_node = ancestor;
+                }
+            }
+
+            if (merge_node != nullptr) {
+                merge(*merge_node);
+            }
+        }
+    }
+
+    // Nodes have no height, their test box depends on the frustum, so culling contexts can't reuse their classification.
+    using AccelerationStructure::query;
+
     void query(const aabbox3& aabbox, std::vector<AccelerationStructurePrimitive*>& output) const override {
         collect_primitives(*this, aabbox, output);
     }
 
     void query(const frustum& frustum, std::vector<AccelerationStructurePrimitive*>& output) const override {
-        float y0 = find_y(frustum.data[0], frustum.data[2], frustum.data[4]);
-        float y1 = find_y(frustum.data[1], frustum.data[2], frustum.data[4]);
-        float y2 = find_y(frustum.data[0], frustum.data[3], frustum.data[4]);
-        float y3 = find_y(frustum.data[1], frustum.data[3], frustum.data[4]);
-        float y4 = find_y(frustum.data[0], frustum.data[2], frustum.data[5]);
-        float y5 = find_y(frustum.data[1], frustum.data[2], frustum.data[5]);
-        float y6 = find_y(frustum.data[0], frustum.data[3], frustum.data[5]);
-        float y7 = find_y(frustum.data[1], frustum.data[3], frustum.data[5]);
+        float y_center;
+        float y_extent;
+        find_y_range(frustum, y_center, y_extent);
 
-        float y_min = std::min({ y0, y1, y2, y3, y4, y5, y6, y7 });
-        float y_max = std::max({ y0, y1, y2, y3, y4, y5, y6, y7 });
+        // The Y range is folded into the planes once, so nodes are tested as 2D boxes.
+        collect_primitives(*this, frustum, frustum_slab_from_frustum(frustum, y_center, y_extent), output);
+    }
 
-        float y_center = (y_max + y_min) / 2.f;
-        float y_extent = (y_max - y_min) / 2.f;
+    // Ids are written straight to the output. Columns have no height, so every primitive is tested, even in nodes that are
+    // entirely within the query in the XZ plane.
+    void query(const aabbox3& aabbox, PrimitiveBitset& output) const override {
+        collect_ids(*this, aabbox, aabbox, output);
+    }
 
-        collect_primitives(*this, frustum, y_center, y_extent, output);
+    void query(const frustum& frustum, PrimitiveBitset& output) const override {
+        float y_center;
+        float y_extent;
+        find_y_range(frustum, y_center, y_extent);
+
+        collect_ids(*this, frustum, frustum_slab_from_frustum(frustum, y_center, y_extent), output);
     }
 
-private:
-    QuadtreeNode& find_node(const aabbox3& bounds, QuadtreeNode& node, uint32_t depth = 0) {
-        if (depth >= m_max_depth) {
-            return node;
+    void query(const aabbox3& aabbox, std::vector<uint32_t>& output) const override {
+        collect_ids(*this, aabbox, aabbox, output);
+    }
+
+    void query(const frustum& frustum, std::vector<uint32_t>& output) const override {
+        float y_center;
+        float y_extent;
+        find_y_range(frustum, y_center, y_extent);
+
+        collect_ids(*this, frustum, frustum_slab_from_frustum(frustum, y_center, y_extent), output);
+    }
+
+    // Each node is visited once with the queries that intersect it.
+    void query(const aabbox3* aabboxes, size_t count, std::vector<AccelerationStructurePrimitive*>* outputs) const override {
+        collect_primitives(aabboxes, aabboxes, count, outputs);
+    }
+
+    void query(const frustum* frustums, size_t count, std::vector<AccelerationStructurePrimitive*>* outputs) const override {
+        std::vector<frustum_slab> slabs(count);
+        for (size_t i = 0; i < count; i++) {
+            float y_center;
+            float y_extent;
+            find_y_range(frustums[i], y_center, y_extent);
+
+            slabs[i] = frustum_slab_from_frustum(frustums[i], y_center, y_extent);
         }
 
+        collect_primitives(frustums, slabs.data(), count, outputs);
+    }
+
+    // Children are culled by the bounds of the sweep, then by the sweep in the XZ plane, since their columns have no
+    // height to cull against.
+    void query(const aabbox3& aabbox, const float3& displacement, std::vector<AccelerationStructureImpact>& output) const override {
+        collect_impacts(*this, aabbox, displacement, get_swept_bounds(aabbox, displacement), output);
+    }
+
+    // Nodes whose part within the frustum's Y range is behind occluders are skipped along with their primitives.
+    void query(const frustum& frustum, const OcclusionBuffer& occlusion_buffer, std::vector<AccelerationStructurePrimitive*>& output) const override {
+        float y_center;
+        float y_extent;
+        find_y_range(frustum, y_center, y_extent);
+
+        collect_primitives(*this, frustum, frustum_slab_from_frustum(frustum, y_center, y_extent), occlusion_buffer, y_center, y_extent, output);
+    }
+
+    // Nodes whose largest primitive would project smaller than `min_size` from the node's distance in the XZ plane are
+    // skipped, children are visited from near to far.
+    void query(const frustum& frustum, const float3& camera_position, float projection_scale, float min_size, std::vector<AccelerationStructurePrimitive*>& output) const override {
+        float y_center;
+        float y_extent;
+        find_y_range(frustum, y_center, y_extent);
+
+        size_t first = output.size();
+        collect_primitives(*this, frustum, frustum_slab_from_frustum(frustum, y_center, y_extent), camera_position, projection_scale, min_size, output);
+        sort_front_to_back(output, first, camera_position);
+    }
+
+private:
+    static bool contains(const aabbox2& node_bounds, const aabbox3& bounds) {
+        return bounds.center.x - bounds.extent.x >= node_bounds.center.x - node_bounds.extent.x &&
+               bounds.center.z - bounds.extent.z >= node_bounds.center.y - node_bounds.extent.y &&
+               bounds.center.x + bounds.extent.x <  node_bounds.center.x + node_bounds.extent.x &&
+               bounds.center.z + bounds.extent.z <  node_bounds.center.y + node_bounds.extent.y;
+    }
+
+    static uint32_t find_child_index(const aabbox3& bounds, const QuadtreeNode& node) {
         uint32_t index = 0;
 
         if (bounds.center.x - bounds.extent.x >= node.bounds.center.x) {
@@ -127,7 +339,7 @@ private:
         } else if (bounds.center.x + bounds.extent.x < node.bounds.center.x) {
             index |= QUADTREE_NEGATIVE_X;
         } else {
-            return node;
+            return QUADTREE_NO_CHILD;
         }
 
         if (bounds.center.z - bounds.extent.z >= node.bounds.center.y) {
@@ -135,28 +347,369 @@ private:
         } else if (bounds.center.z + bounds.extent.z < node.bounds.center.y) {
             index |= QUADTREE_NEGATIVE_Y;
         } else {
+            return QUADTREE_NO_CHILD;
+        }
+
+        return index;
+    }
+
+    QuadtreeNode& find_node(const aabbox3& bounds) {
+        while (m_growth < m_max_growth && !contains(this->bounds, bounds)) {
+            grow(bounds);
+        }
+
+        // Primitives that don't fit the root can't be put in any child node.
+        return contains(this->bounds, bounds) ? find_node(bounds, *this) : *this;
+    }
+
+    QuadtreeNode& find_node(const aabbox3& bounds, QuadtreeNode& node, uint32_t depth = 0) {
+        if (depth >= m_max_depth || !node.subdivided) {
             return node;
         }
 
-        std::unique_ptr<QuadtreeNode>& child = node.children[index];
+        uint32_t index = find_child_index(bounds, node);
+        if (index == QUADTREE_NO_CHILD) {
+            return node;
+        }
+
+        return find_node(bounds, get_child(node, index), depth + 1);
+    }
+
+    static aabbox2 get_child_bounds(const aabbox2& bounds, uint32_t index) {
+        float extent_x = bounds.extent.x / 2.f;
+        float extent_y = bounds.extent.y / 2.f;
+
+        float center_x = bounds.center.x + QUADTREE_EXTENT_FACTORS[index].x * extent_x;
+        float center_y = bounds.center.y + QUADTREE_EXTENT_FACTORS[index].y * extent_y;
+
+        return aabbox2{
+            float2{ center_x, center_y },
+            float2{ extent_x, extent_y }
+        };
+    }
+
+    // Children bounds in structure of arrays layout.
+    static aabbox2x4 get_child_bounds(const aabbox2& bounds) {
+        aabbox2x4 result;
+        for (uint32_t i = 0; i < 4; i++) {
+            set_aabbox(result, i, get_child_bounds(bounds, i));
+        }
+        return result;
+    }
+
+    // Bit `i` is set when child `i` exists.
+    static uint32_t get_child_mask(const QuadtreeNode& node) {
+        uint32_t result = 0;
+        for (uint32_t i = 0; i < 4; i++) {
+            result |= static_cast<uint32_t>(node.children[i] != nullptr) << i;
+        }
+        return result;
+    }
+
+    // Bit `i` is set when child `i` exists and intersects the query. Children bounds are derived from the node's bounds
+    // and tested all at once, without touching the children themselves.
+    template <typename Bounds>
+    static uint32_t intersect_children(const QuadtreeNode& node, const Bounds& bounds) {
+        uint32_t mask = get_child_mask(node);
+        if (mask == 0) {
+            return 0;
+        }
+
+        uint32_t result = mask & ~node.irregular_children & intersect(get_child_bounds(node.bounds), bounds);
+
+        uint32_t irregular = mask & node.irregular_children;
+        for (uint32_t index = 0; irregular >> index != 0; index++) {
+            if (((irregular >> index) & 1) && intersect(node.children[index]->bounds, bounds)) {
+                result |= 1 << index;
+            }
+        }
+
+        return result;
+    }
+
+    QuadtreeNode& get_child(QuadtreeNode& node, uint32_t index) {
+        std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>& child = node.children[index];
         if (!child) {
-            float extent_x = node.bounds.extent.x / 2.f;
-            float extent_y = node.bounds.extent.y / 2.f;
+            child = std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>(new (memory_resource.allocate(sizeof(QuadtreeNode))) QuadtreeNode(memory_resource));
+            child->bounds = get_child_bounds(node.bounds, index);
+            child->parent = &node;
+            child->subdivided = m_split_threshold == 0;
+        }
+        return *child;
+    }
 
-            float center_x = node.bounds.center.x + QUADTREE_EXTENT_FACTORS[index].x * extent_x;
-            float center_y = node.bounds.center.y + QUADTREE_EXTENT_FACTORS[index].y * extent_y;
+    void insert(QuadtreeNode& node, AccelerationStructurePrimitive& primitive) {
+        node.primitives.push_back(&primitive);
+
+        primitive.m_node = &node;
 
-            child = std::unique_ptr<QuadtreeNode>(new (memory_resource.allocate(sizeof(QuadtreeNode))) QuadtreeNode(memory_resource));
-            child->bounds = aabbox2{
-                float2{ center_x, center_y },
-                float2{ extent_x, extent_y }
-            };
+        expand_max_extent(node, primitive.get_bounds());
+
+        if (m_split_threshold != 0) {
+            for (QuadtreeNode* ancestor = &node; ancestor != nullptr; ancestor = ancestor->parent) {
+                ancestor->count++;
+            }
+
+            if (!node.subdivided && node.primitives.size() > m_split_threshold) {
+                uint32_t depth = get_depth(node);
+                if (depth < m_max_depth) {
+                    split(node, depth);
+                }
+            }
         }
+    }
+
+    void erase(QuadtreeNode& node, AccelerationStructurePrimitive& primitive) {
+        auto it = std::find(node.primitives.begin(), node.primitives.end(), &primitive);
+        assert(it != node.primitives.end());
+
+        *it = node.primitives.back();
+        node.primitives.pop_back();
+
+        primitive.m_node = nullptr;
+
+        if (m_split_threshold != 0) {
+            // Merge the topmost subtree that fell below the low-water mark.
+            QuadtreeNode* merge_node = nullptr;
+
+            for (QuadtreeNode* ancestor = &node; ancestor != nullptr; ancestor = ancestor->parent) {
+                assert(ancestor->count > 0);
+                ancestor->count--;
 
-        return find_node(bounds, *child, depth + 1);
+                if (ancestor->subdivided && ancestor->count <= m_merge_threshold) {
+                    merge_node = ancestor;
+                }
+            }
+
+            if (merge_node != nullptr) {
+                merge(*merge_node);
+            }
+        }
     }
 
-    float find_y(const plane& p1, const plane& p2, const plane& p3) const {
+    static void expand_max_extent(QuadtreeNode& node, const aabbox3& bounds) {
+        float extent_squared = dot(bounds.extent, bounds.extent);
+        for (QuadtreeNode* ancestor = &node; ancestor != nullptr && ancestor->max_extent_squared < extent_squared; ancestor = ancestor->parent) {
+            ancestor->max_extent_squared = extent_squared;
+        }
+    }
+
+    uint32_t get_depth(const QuadtreeNode& node) const {
+        uint32_t depth = 0;
+        for (const QuadtreeNode* ancestor = node.parent; ancestor != nullptr; ancestor = ancestor->parent) {
+            depth++;
+        }
+        return depth;
+    }
+
+    void split(QuadtreeNode& node, uint32_t depth) {
+        assert(!node.subdivided);
+
+        node.subdivided = true;
+
+        // Primitives that straddle the node's center stay in the node, so do primitives of the root that don't fit it.
+        for (size_t i = 0; i < node.primitives.size();) {
+            AccelerationStructurePrimitive* primitive = node.primitives[i];
+
+            uint32_t index = contains(node.bounds, primitive->get_bounds()) ? find_child_index(primitive->get_bounds(), node) : QUADTREE_NO_CHILD;
+            if (index != QUADTREE_NO_CHILD) {
+                QuadtreeNode& child = get_child(node, index);
+                child.primitives.push_back(primitive);
+                child.count++;
+
+                primitive->m_node = &child;
+
+                expand_max_extent(child, primitive->get_bounds());
+
+                node.primitives[i] = node.primitives.back();
+                node.primitives.pop_back();
+            } else {
+                i++;
+            }
+        }
+
+        if (depth + 1 < m_max_depth) {
+            for (std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>& child : node.children) {
+                if (child && child->primitives.size() > m_split_threshold) {
+                    split(*child, depth + 1);
+                }
+            }
+        }
+    }
+
+    void grow(const aabbox3& bounds) {
+        // The current root becomes the child on the opposite side from the primitive.
+        uint32_t index = 0;
+        index |= bounds.center.x < this->bounds.center.x ? QUADTREE_POSITIVE_X : QUADTREE_NEGATIVE_X;
+        index |= bounds.center.z < this->bounds.center.y ? QUADTREE_POSITIVE_Y : QUADTREE_NEGATIVE_Y;
+
+        std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter> child(new (memory_resource.allocate(sizeof(QuadtreeNode))) QuadtreeNode(memory_resource));
+        child->bounds = this->bounds;
+        child->parent = this;
+        child->subdivided = subdivided;
+        child->max_extent_squared = max_extent_squared;
+        child->irregular_children = irregular_children;
+
+        for (size_t i = 0; i < 4; i++) {
+            if (children[i]) {
+                children[i]->parent = child.get();
+                child->count += children[i]->count;
+                child->children[i] = std::move(children[i]);
+            }
+        }
+
+        this->bounds.center.x -= QUADTREE_EXTENT_FACTORS[index].x * this->bounds.extent.x;
+        this->bounds.center.y -= QUADTREE_EXTENT_FACTORS[index].y * this->bounds.extent.y;
+        this->bounds.extent.x *= 2.f;
+        this->bounds.extent.y *= 2.f;
+
+        children[index] = std::move(child);
+        subdivided = true;
+        irregular_children = static_cast<uint8_t>(1 << index);
+
+        m_max_depth++;
+        m_growth++;
+
+        // Primitives that straddled the old center or didn't fit the old root may go deeper now.
+        std::vector<AccelerationStructurePrimitive*, CountAllocator<AccelerationStructurePrimitive*>> root_primitives(memory_resource);
+        root_primitives.swap(primitives);
+
+        if (m_split_threshold != 0) {
+            count -= static_cast<uint32_t>(root_primitives.size());
+        }
+
+        for (AccelerationStructurePrimitive* primitive : root_primitives) {
+            const aabbox3& primitive_bounds = primitive->get_bounds();
+            insert(contains(this->bounds, primitive_bounds) ? find_node(primitive_bounds, *this) : *this, *primitive);
+        }
+    }
+
+    void merge(QuadtreeNode& node) {
+        assert(node.subdivided);
+
+        for (std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>& child : node.children) {
+            if (child) {
+                gather_primitives(*child, node);
+                child.reset();
+            }
+        }
+
+        node.subdivided = false;
+    }
+
+    void gather_primitives(QuadtreeNode& source, QuadtreeNode& destination) {
+        for (AccelerationStructurePrimitive* primitive : source.primitives) {
+            destination.primitives.push_back(primitive);
+            primitive->m_node = &destination;
+        }
+
+        for (std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>& child : source.children) {
+            if (child) {
+                gather_primitives(*child, destination);
+            }
+        }
+    }
+
+    void gather_primitives(const QuadtreeNode& source, std::vector<AccelerationStructurePrimitive*>& output) {
+        output.insert(output.end(), source.primitives.begin(), source.primitives.end());
+
+        for (const std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>& child : source.children) {
+            if (child) {
+                gather_primitives(*child, output);
+            }
+        }
+    }
+
+    // Child bounds are computed the same way everywhere, so the bounds of the same node are exactly equal.
+    static bool is_same_bounds(const aabbox2& lhs, const aabbox2& rhs) {
+        return lhs.center.x == rhs.center.x && lhs.center.y == rhs.center.y && lhs.extent.x == rhs.extent.x && lhs.extent.y == rhs.extent.y;
+    }
+
+    // Index of the child that contains the point, points on the center belong to the positive side.
+    static uint32_t get_tile_index(const float2& point, const aabbox2& bounds) {
+        uint32_t index = 0;
+        index |= point.x >= bounds.center.x ? QUADTREE_POSITIVE_X : QUADTREE_NEGATIVE_X;
+        index |= point.y >= bounds.center.y ? QUADTREE_POSITIVE_Y : QUADTREE_NEGATIVE_Y;
+        return index;
+    }
+
+    // Creates nodes down to the parent of the tile's node. They're all subdivided, so primitives can reach the tile.
+    QuadtreeNode& get_tile_parent(const aabbox2& tile_bounds) {
+        assert(tile_bounds.extent.x < bounds.extent.x);
+
+        QuadtreeNode* node = this;
+        node->subdivided = true;
+
+        while (node->bounds.extent.x / 2.f > tile_bounds.extent.x) {
+            node = &get_child(*node, get_tile_index(tile_bounds.center, node->bounds));
+            node->subdivided = true;
+        }
+
+        assert(is_same_bounds(get_child_bounds(node->bounds, get_tile_index(tile_bounds.center, node->bounds)), tile_bounds));
+        return *node;
+    }
+
+    QuadtreeNode* find_tile_parent(const aabbox2& tile_bounds) {
+        QuadtreeNode* node = this;
+
+        while (node != nullptr && node->bounds.extent.x / 2.f > tile_bounds.extent.x) {
+            node = node->children[get_tile_index(tile_bounds.center, node->bounds)].get();
+        }
+
+        return node;
+    }
+
+    // Unlinks a subtree and removes its primitives from the ancestors' count. Doesn't merge the ancestors.
+    std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter> take_child(QuadtreeNode& node, uint32_t index) {
+        std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter> child = std::move(node.children[index]);
+        child->parent = nullptr;
+
+        if (m_split_threshold != 0) {
+            for (QuadtreeNode* ancestor = &node; ancestor != nullptr; ancestor = ancestor->parent) {
+                assert(ancestor->count >= child->count);
+                ancestor->count -= child->count;
+            }
+        }
+
+        return child;
+    }
+
+    void put_child(QuadtreeNode& node, uint32_t index, std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter> child) {
+        assert(!node.children[index]);
+
+        for (QuadtreeNode* ancestor = &node; ancestor != nullptr; ancestor = ancestor->parent) {
+            if (m_split_threshold != 0) {
+                ancestor->count += child->count;
+            }
+            ancestor->max_extent_squared = std::max(ancestor->max_extent_squared, child->max_extent_squared);
+        }
+
+        if (!is_same_bounds(child->bounds, get_child_bounds(node.bounds, index))) {
+            node.irregular_children |= 1 << index;
+        }
+
+        child->parent = &node;
+        node.children[index] = std::move(child);
+    }
+
+    static void find_y_range(const frustum& frustum, float& y_center, float& y_extent) {
+        float y0 = find_y(frustum.data[0], frustum.data[2], frustum.data[4]);
+        float y1 = find_y(frustum.data[1], frustum.data[2], frustum.data[4]);
+        float y2 = find_y(frustum.data[0], frustum.data[3], frustum.data[4]);
+        float y3 = find_y(frustum.data[1], frustum.data[3], frustum.data[4]);
+        float y4 = find_y(frustum.data[0], frustum.data[2], frustum.data[5]);
+        float y5 = find_y(frustum.data[1], frustum.data[2], frustum.data[5]);
+        float y6 = find_y(frustum.data[0], frustum.data[3], frustum.data[5]);
+        float y7 = find_y(frustum.data[1], frustum.data[3], frustum.data[5]);
+
+        float y_min = std::min({ y0, y1, y2, y3, y4, y5, y6, y7 });
+        float y_max = std::max({ y0, y1, y2, y3, y4, y5, y6, y7 });
+
+        y_center = (y_max + y_min) / 2.f;
+        y_extent = (y_max - y_min) / 2.f;
+    }
+
+    static float find_y(const plane& p1, const plane& p2, const plane& p3) {
         float det = p1.normal.x * p2.normal.y * p3.normal.z +
                     p1.normal.y * p2.normal.z * p3.normal.x +
                     p1.normal.z * p2.normal.x * p3.normal.y -
@@ -183,14 +736,76 @@ private:
             }
         }
 
-        for (const std::unique_ptr<QuadtreeNode>& child : node.children) {
-            if (child && intersect(child->bounds, bounds)) {
-                collect_primitives(*child, bounds, output);
+        uint32_t mask = intersect_children(node, bounds);
+        for (uint32_t index = 0; mask >> index != 0; index++) {
+            if ((mask >> index) & 1) {
+                collect_primitives(*node.children[index], bounds, output);
             }
         }
     }
     
-    void collect_primitives(const QuadtreeNode& node, const frustum& bounds, float y_center, float y_extent, std::vector<AccelerationStructurePrimitive*>& output) const {
+    void collect_impacts(const QuadtreeNode& node, const aabbox3& aabbox, const float3& displacement, const aabbox3& swept_bounds, std::vector<AccelerationStructureImpact>& output) const {
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            float time;
+            if (intersect(primitive->get_bounds(), swept_bounds) && intersect(aabbox, displacement, primitive->get_bounds(), time)) {
+                output.push_back(AccelerationStructureImpact{ primitive, time });
+            }
+        }
+
+        uint32_t mask = intersect_children(node, swept_bounds);
+        for (uint32_t index = 0; mask >> index != 0; index++) {
+            float time;
+            if (((mask >> index) & 1) && intersect(aabbox, displacement, node.children[index]->bounds, time)) {
+                collect_impacts(*node.children[index], aabbox, displacement, swept_bounds, output);
+            }
+        }
+    }
+
+    void collect_primitives(const QuadtreeNode& node, const frustum& frustum, const frustum_slab& slab, const OcclusionBuffer& occlusion_buffer, float y_center, float y_extent, std::vector<AccelerationStructurePrimitive*>& output) const {
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            if (intersect(primitive->get_bounds(), frustum) && !occlusion_buffer.is_occluded(primitive->get_bounds())) {
+                output.push_back(primitive);
+            }
+        }
+
+        uint32_t mask = intersect_children(node, slab);
+        for (uint32_t index = 0; mask >> index != 0; index++) {
+            if ((mask >> index) & 1) {
+                const QuadtreeNode& child = *node.children[index];
+                aabbox3 child_bounds{
+                    float3{ child.bounds.center.x, y_center, child.bounds.center.y },
+                    float3{ child.bounds.extent.x, y_extent, child.bounds.extent.y }
+                };
+                if (!occlusion_buffer.is_occluded(child_bounds)) {
+                    collect_primitives(child, frustum, slab, occlusion_buffer, y_center, y_extent, output);
+                }
+            }
+        }
+    }
+
+    void collect_primitives(const QuadtreeNode& node, const frustum& frustum, const frustum_slab& slab, const float3& camera_position, float projection_scale, float min_size, std::vector<AccelerationStructurePrimitive*>& output) const {
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            if (intersect(primitive->get_bounds(), frustum) && !is_smaller(primitive->get_bounds(), camera_position, projection_scale, min_size)) {
+                output.push_back(primitive);
+            }
+        }
+
+        uint32_t nearest = 0;
+        nearest |= camera_position.x >= node.bounds.center.x ? QUADTREE_POSITIVE_X : QUADTREE_NEGATIVE_X;
+        nearest |= camera_position.z >= node.bounds.center.y ? QUADTREE_POSITIVE_Y : QUADTREE_NEGATIVE_Y;
+
+        uint32_t mask = intersect_children(node, slab);
+
+        // Primitives of a child are no closer than its column and no larger than its largest primitive.
+        for (uint32_t order : QUADTREE_NEAR_TO_FAR) {
+            const std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>& child = node.children[nearest ^ order];
+            if (((mask >> (nearest ^ order)) & 1) && !is_smaller(child->max_extent_squared, distance_squared(camera_position, child->bounds), projection_scale, min_size)) {
+                collect_primitives(*child, frustum, slab, camera_position, projection_scale, min_size, output);
+            }
+        }
+    }
+
+    void collect_primitives(const QuadtreeNode& node, const frustum& bounds, const frustum_slab& slab, std::vector<AccelerationStructurePrimitive*>& output) const {
         output.reserve(output.size() + node.primitives.size());
 
         for (AccelerationStructurePrimitive* primitive : node.primitives) {
@@ -199,14 +814,74 @@ private:
             }
         }
 
-        for (const std::unique_ptr<QuadtreeNode>& child : node.children) {
+        uint32_t mask = intersect_children(node, slab);
+        for (uint32_t index = 0; mask >> index != 0; index++) {
+            if ((mask >> index) & 1) {
+                collect_primitives(*node.children[index], bounds, slab, output);
+            }
+        }
+    }
+
+    static void push(PrimitiveBitset& output, const AccelerationStructurePrimitive& primitive) {
+        output.set(primitive.get_id());
+    }
+
+    static void push(std::vector<uint32_t>& output, const AccelerationStructurePrimitive& primitive) {
+        output.push_back(primitive.get_id());
+    }
+
+    // Children are culled by `child_bounds`, which is the query itself or the frustum slab of a frustum query.
+    template <typename Bounds, typename ChildBounds, typename Output>
+    void collect_ids(const QuadtreeNode& node, const Bounds& bounds, const ChildBounds& child_bounds, Output& output) const {
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            if (intersect(primitive->get_bounds(), bounds)) {
+                push(output, *primitive);
+            }
+        }
+
+        uint32_t mask = intersect_children(node, child_bounds);
+        for (uint32_t index = 0; mask >> index != 0; index++) {
+            if ((mask >> index) & 1) {
+                collect_ids(*node.children[index], bounds, child_bounds, output);
+            }
+        }
+    }
+
+    template <typename Bounds, typename ChildBounds>
+    void collect_primitives(const Bounds* bounds, const ChildBounds* child_bounds, size_t count, std::vector<AccelerationStructurePrimitive*>* outputs) const {
+        std::vector<uint32_t> indices(count);
+        for (size_t i = 0; i < count; i++) {
+            indices[i] = static_cast<uint32_t>(i);
+        }
+
+        collect_primitives(*this, bounds, child_bounds, indices, 0, outputs);
+    }
+
+    // Queries of a node are `indices` starting at `first`. Queries of its children are appended after them while the
+    // child is visited. Children are culled by `child_bounds`, like in `collect_ids`.
+    template <typename Bounds, typename ChildBounds>
+    void collect_primitives(const QuadtreeNode& node, const Bounds* bounds, const ChildBounds* child_bounds, std::vector<uint32_t>& indices, size_t first, std::vector<AccelerationStructurePrimitive*>* outputs) const {
+        size_t last = indices.size();
+
+        for (AccelerationStructurePrimitive* primitive : node.primitives) {
+            for (size_t i = first; i < last; i++) {
+                if (intersect(primitive->get_bounds(), bounds[indices[i]])) {
+                    outputs[indices[i]].push_back(primitive);
+                }
+            }
+        }
+
+        for (const std::unique_ptr<QuadtreeNode, QuadtreeNodeDeleter>& child : node.children) {
             if (child) {
-                aabbox3 child_bounds{
-                    float3{ child->bounds.center.x, y_center, child->bounds.center.y },
-                    float3{ child->bounds.extent.x, y_extent, child->bounds.extent.y }
-                };
-                if (intersect(child_bounds, bounds)) {
-                    collect_primitives(*child, bounds, y_center, y_extent, output);
+                for (size_t i = first; i < last; i++) {
+                    if (intersect(child->bounds, child_bounds[indices[i]])) {
+                        indices.push_back(indices[i]);
+                    }
+                }
+
+                if (indices.size() > last) {
+                    collect_primitives(*child, bounds, child_bounds, indices, last, outputs);
+                    indices.resize(last);
                 }
             }
         }
@@ -214,4 +889,10 @@ private:
 
     CountMemoryResource& memory_resource;
     uint32_t m_max_depth;
+    uint32_t m_split_threshold;
+    uint32_t m_merge_threshold;
+    uint32_t m_max_growth;
+    uint32_t m_growth;
+
+    friend class CompactQuadtree;
 };
@@ -0,0 +1,291 @@
+#pragma once
+
+#include "acceleration_structure.h"
+#include "count_allocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <functional>
+#include <vector>
+
+constexpr uint32_t STATIC_BVH_BIN_COUNT = 16;
+constexpr uint32_t STATIC_BVH_MIN_LEAF_SIZE = 4;
+constexpr uint32_t STATIC_BVH_MAX_LEAF_SIZE = 16;
+constexpr uint32_t STATIC_BVH_MAX_DEPTH = 64;
+
+// Cost of visiting a node relative to testing one primitive.
+constexpr float STATIC_BVH_TRAVERSAL_COST = 1.f;
+
+struct StaticBvhNode {
+    aabbox3 bounds;
+
+    // Inner nodes have two children at `first` and `first + 1`. Leaves have `count` primitives starting at `first`.
+    uint32_t first;
+    uint32_t count;
+};
+
+// Bounds are copied, so queries don't touch the primitives until they're output.
+struct StaticBvhPrimitive {
+    aabbox3 bounds;
+
+    // Null when the primitive was removed.
+    AccelerationStructurePrimitive* primitive;
+};
+
+// Bounding volume hierarchy built once over primitives that never move, using the surface area heuristic. Nodes and
+// primitives are stored in two flat arrays. Primitives can be removed, but not added or updated.
+class StaticBvh {
+public:
+    StaticBvh(CountMemoryResource& memory_resource)
+        : m_nodes(memory_resource)
+        , m_primitives(memory_resource)
+    {
+    }
+
+    StaticBvh(const StaticBvh&) = delete;
+    StaticBvh& operator=(const StaticBvh&) = delete;
+
+    // Replaces the current contents. Primitives must not be in another acceleration structure.
+    void build(AccelerationStructurePrimitive* const* primitives, size_t count) {
+        m_nodes.clear();
+        m_primitives.clear();
+        m_removed = 0;
+
+        m_primitives.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            m_primitives.push_back(StaticBvhPrimitive{ primitives[i]->get_bounds(), primitives[i] });
+        }
+
+        m_nodes.push_back(StaticBvhNode{ aabbox3{}, 0, static_cast<uint32_t>(count) });
+
+        if (count > 0) {
+            split(0, 0);
+        }
+
+        m_nodes.shrink_to_fit();
+
+        for (StaticBvhPrimitive& primitive : m_primitives) {
+            primitive.primitive->m_node = &primitive;
+        }
+    }
+
+    bool contains(const AccelerationStructurePrimitive& primitive) const {
+        // Node pointers of other acceleration structures point to unrelated objects, which only `std::less` can compare.
+        std::less<const void*> less;
+        return !less(primitive.m_node, m_primitives.data()) && less(primitive.m_node, m_primitives.data() + m_primitives.size());
+    }
+
+    // Leaves the primitive's slot empty, nodes are not refitted.
+    void remove(AccelerationStructurePrimitive& primitive) {
+        assert(contains(primitive));
+
+        StaticBvhPrimitive* slot = static_cast<StaticBvhPrimitive*>(primitive.m_node);
+        assert(slot->primitive == &primitive);
+
+        slot->primitive = nullptr;
+        primitive.m_node = nullptr;
+
+        m_removed++;
+    }
+
+    size_t get_size() const {
+        return m_primitives.size() - m_removed;
+    }
+
+    // Primitives that are still referenced by the tree, for rebuilding it.
+    void get_primitives(std::vector<AccelerationStructurePrimitive*>& output) const {
+        for (const StaticBvhPrimitive& primitive : m_primitives) {
+            if (primitive.primitive != nullptr) {
+                output.push_back(primitive.primitive);
+            }
+        }
+    }
+
+    void query(const aabbox3& aabbox, std::vector<AccelerationStructurePrimitive*>& output) const {
+        collect_primitives(aabbox, output);
+    }
+
+    void query(const frustum& frustum, std::vector<AccelerationStructurePrimitive*>& output) const {
+        collect_primitives(frustum, output);
+    }
+
+private:
+    struct Range {
+        float3 min;
+        float3 max;
+    };
+
+    static Range get_empty_range() {
+        return Range{ float3{ FLT_MAX, FLT_MAX, FLT_MAX }, float3{ -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+    }
+
+    static void expand(Range& range, const float3& min, const float3& max) {
+        range.min = float3{ std::min(range.min.x, min.x), std::min(range.min.y, min.y), std::min(range.min.z, min.z) };
+        range.max = float3{ std::max(range.max.x, max.x), std::max(range.max.y, max.y), std::max(range.max.z, max.z) };
+    }
+
+    static void expand(Range& range, const aabbox3& bounds) {
+        expand(range, sub(bounds.center, bounds.extent), float3{ bounds.center.x + bounds.extent.x, bounds.center.y + bounds.extent.y, bounds.center.z + bounds.extent.z });
+    }
+
+    static float get_half_area(const Range& range) {
+        if (range.min.x > range.max.x) {
+            return 0.f;
+        }
+
+        float3 size = sub(range.max, range.min);
+        return size.x * size.y + size.y * size.z + size.z * size.x;
+    }
+
+    static float get_axis(const float3& value, uint32_t axis) {
+        return axis == 0 ? value.x : axis == 1 ? value.y : value.z;
+    }
+
+    void split(uint32_t index, uint32_t depth) {
+        uint32_t first = m_nodes[index].first;
+        uint32_t count = m_nodes[index].count;
+
+        Range bounds = get_empty_range();
+        Range centers = get_empty_range();
+
+        for (uint32_t i = first; i < first + count; i++) {
+            expand(bounds, m_primitives[i].bounds);
+            expand(centers, m_primitives[i].bounds.center, m_primitives[i].bounds.center);
+        }
+
+        m_nodes[index].bounds = aabbox3{
+            float3{ (bounds.min.x + bounds.max.x) / 2.f, (bounds.min.y + bounds.max.y) / 2.f, (bounds.min.z + bounds.max.z) / 2.f },
+            float3{ (bounds.max.x - bounds.min.x) / 2.f, (bounds.max.y - bounds.min.y) / 2.f, (bounds.max.z - bounds.min.z) / 2.f }
+        };
+
+        if (count <= STATIC_BVH_MIN_LEAF_SIZE || depth + 1 >= STATIC_BVH_MAX_DEPTH) {
+            return;
+        }
+
+        float3 center_size = sub(centers.max, centers.min);
+        uint32_t axis = center_size.x >= center_size.y && center_size.x >= center_size.z ? 0 : center_size.y >= center_size.z ? 1 : 2;
+
+        float axis_min = get_axis(centers.min, axis);
+        float axis_size = get_axis(center_size, axis);
+
+        uint32_t middle;
+
+        if (axis_size > 0.f) {
+            uint32_t bin_counts[STATIC_BVH_BIN_COUNT] = {};
+            Range bin_bounds[STATIC_BVH_BIN_COUNT];
+            std::fill(std::begin(bin_bounds), std::end(bin_bounds), get_empty_range());
+
+            float bin_scale = STATIC_BVH_BIN_COUNT / axis_size;
+
+            auto get_bin = [&](const StaticBvhPrimitive& primitive) {
+                uint32_t bin = static_cast<uint32_t>((get_axis(primitive.bounds.center, axis) - axis_min) * bin_scale);
+                return std::min(bin, STATIC_BVH_BIN_COUNT - 1);
+            };
+
+            for (uint32_t i = first; i < first + count; i++) {
+                uint32_t bin = get_bin(m_primitives[i]);
+                bin_counts[bin]++;
+                expand(bin_bounds[bin], m_primitives[i].bounds);
+            }
+
+            // Sweep from the right to know the cost of the right side of each split.
+            float right_costs[STATIC_BVH_BIN_COUNT];
+            Range right = get_empty_range();
+            uint32_t right_count = 0;
+
+            for (uint32_t i = STATIC_BVH_BIN_COUNT - 1; i > 0; i--) {
+                expand(right, bin_bounds[i].min, bin_bounds[i].max);
+                right_count += bin_counts[i];
+                right_costs[i] = get_half_area(right) * right_count;
+            }
+
+            Range left = get_empty_range();
+            uint32_t left_count = 0;
+
+            float best_cost = FLT_MAX;
+            uint32_t best_split = 0;
+
+            for (uint32_t i = 1; i < STATIC_BVH_BIN_COUNT; i++) {
+                expand(left, bin_bounds[i - 1].min, bin_bounds[i - 1].max);
+                left_count += bin_counts[i - 1];
+
+                float cost = get_half_area(left) * left_count + right_costs[i];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_split = i;
+                }
+            }
+
+            float leaf_cost = get_half_area(bounds) * count;
+            float split_cost = get_half_area(bounds) * STATIC_BVH_TRAVERSAL_COST + best_cost;
+
+            if (split_cost >= leaf_cost && count <= STATIC_BVH_MAX_LEAF_SIZE) {
+                return;
+            }
+
+            middle = static_cast<uint32_t>(std::partition(m_primitives.begin() + first, m_primitives.begin() + first + count, [&](const StaticBvhPrimitive& primitive) {
+                return get_bin(primitive) < best_split;
+            }) - m_primitives.begin());
+        } else {
+            // All centers are the same, split in half to keep leaves small.
+            if (count <= STATIC_BVH_MAX_LEAF_SIZE) {
+                return;
+            }
+
+            middle = first + count / 2;
+        }
+
+        if (middle == first || middle == first + count) {
+            middle = first + count / 2;
+        }
+
+        uint32_t left_index = static_cast<uint32_t>(m_nodes.size());
+
+        m_nodes[index].first = left_index;
+        m_nodes[index].count = 0;
+
+        m_nodes.push_back(StaticBvhNode{ aabbox3{}, first, middle - first });
+        m_nodes.push_back(StaticBvhNode{ aabbox3{}, middle, first + count - middle });
+
+        split(left_index, depth + 1);
+        split(left_index + 1, depth + 1);
+    }
+
+    template <typename Bounds>
+    void collect_primitives(const Bounds& bounds, std::vector<AccelerationStructurePrimitive*>& output) const {
+        if (m_primitives.empty()) {
+            return;
+        }
+
+        // Each level leaves at most one sibling on the stack.
+        uint32_t stack[STATIC_BVH_MAX_DEPTH + 1];
+        uint32_t stack_size = 0;
+
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0) {
+            const StaticBvhNode& node = m_nodes[stack[--stack_size]];
+
+            if (!intersect(node.bounds, bounds)) {
+                continue;
+            }
+
+            if (node.count > 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    const StaticBvhPrimitive& primitive = m_primitives[i];
+                    if (primitive.primitive != nullptr && intersect(primitive.bounds, bounds)) {
+                        output.push_back(primitive.primitive);
+                    }
+                }
+            } else {
+                stack[stack_size++] = node.first + 1;
+                stack[stack_size++] = node.first;
+            }
+        }
+    }
+
+    std::vector<StaticBvhNode, CountAllocator<StaticBvhNode>> m_nodes;
+    std::vector<StaticBvhPrimitive, CountAllocator<StaticBvhPrimitive>> m_primitives;
+    size_t m_removed = 0;
+};
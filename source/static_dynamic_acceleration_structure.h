@@ -0,0 +1,144 @@
+#pragma once
+
+#include "acceleration_structure.h"
+#include "count_allocator.h"
+#include "static_bvh.h"
+
+#include <cassert>
+#include <functional>
+#include <unordered_set>
+
+// Keeps primitives that never move in a static BVH and everything else in a dynamic acceleration structure, which only
+// has to deal with the few moving primitives. Queries output primitives from both.
+//
+// Any acceleration structure can be the dynamic one, whatever it keeps in the primitive's node. Primitives given to it
+// are tracked in a set, which is small as long as most primitives are static.
+class StaticDynamicAccelerationStructure : public AccelerationStructure {
+public:
+    StaticDynamicAccelerationStructure(CountMemoryResource& memory_resource, AccelerationStructure& dynamic)
+        : m_static(memory_resource)
+        , m_pending(memory_resource)
+        , m_dynamic_primitives(CountAllocator<const AccelerationStructurePrimitive*>(memory_resource))
+        , m_dynamic(dynamic)
+    {
+    }
+
+    // Static primitives are queried linearly until the next `build`.
+    void add_static(AccelerationStructurePrimitive& primitive) {
+        if (m_pending.size() == m_pending.capacity()) {
+            m_pending.push_back(&primitive);
+
+            // Pending primitives point to their slots, which have moved.
+            for (AccelerationStructurePrimitive*& slot : m_pending) {
+                slot->m_node = &slot;
+            }
+        } else {
+            m_pending.push_back(&primitive);
+            primitive.m_node = &m_pending.back();
+        }
+    }
+
+    // Rebuilds the static BVH with the static primitives added since the last build. Also gets rid of the slots
+    // left by removed static primitives.
+    void build() {
+        std::vector<AccelerationStructurePrimitive*> primitives;
+        primitives.reserve(m_static.get_size() + m_pending.size());
+
+        m_static.get_primitives(primitives);
+        primitives.insert(primitives.end(), m_pending.begin(), m_pending.end());
+
+        m_static.build(primitives.data(), primitives.size());
+        m_pending.clear();
+        m_pending.shrink_to_fit();
+    }
+
+    void add(AccelerationStructurePrimitive& primitive) override {
+        add_dynamic(primitive);
+    }
+
+    void remove(AccelerationStructurePrimitive& primitive) override {
+        if (m_dynamic_primitives.erase(&primitive) != 0) {
+            m_dynamic.remove(primitive);
+        } else {
+            remove_static(primitive);
+        }
+    }
+
+    // A static primitive that moves anyway is moved to the dynamic structure for good.
+    void update(AccelerationStructurePrimitive& primitive) override {
+        if (m_dynamic_primitives.count(&primitive) != 0) {
+            m_dynamic.update(primitive);
+        } else {
+            remove_static(primitive);
+            add_dynamic(primitive);
+        }
+    }
+
+    using AccelerationStructure::query;
+
+    void query(const aabbox3& aabbox, std::vector<AccelerationStructurePrimitive*>& output) const override {
+        m_static.query(aabbox, output);
+
+        for (AccelerationStructurePrimitive* primitive : m_pending) {
+            if (intersect(primitive->get_bounds(), aabbox)) {
+                output.push_back(primitive);
+            }
+        }
+
+        m_dynamic.query(aabbox, output);
+    }
+
+    void query(const frustum& frustum, std::vector<AccelerationStructurePrimitive*>& output) const override {
+        m_static.query(frustum, output);
+
+        for (AccelerationStructurePrimitive* primitive : m_pending) {
+            if (intersect(primitive->get_bounds(), frustum)) {
+                output.push_back(primitive);
+            }
+        }
+
+        m_dynamic.query(frustum, output);
+    }
+
+private:
+    void add_dynamic(AccelerationStructurePrimitive& primitive) {
+        m_dynamic_primitives.insert(&primitive);
+
+        // The dynamic structure may not write the node, which must not be mistaken for a static one later.
+        primitive.m_node = nullptr;
+        m_dynamic.add(primitive);
+    }
+
+    // Node of a static primitive points either to its BVH slot or to its slot in `m_pending`.
+    void remove_static(AccelerationStructurePrimitive& primitive) {
+        if (m_static.contains(primitive)) {
+            m_static.remove(primitive);
+        } else {
+            remove_pending(primitive);
+        }
+    }
+
+    // Pending primitives point to their slots in `m_pending`, so they're found and removed in constant time.
+    bool is_pending(const AccelerationStructurePrimitive& primitive) const {
+        std::less<const void*> less;
+        return !less(primitive.m_node, m_pending.data()) && less(primitive.m_node, m_pending.data() + m_pending.size());
+    }
+
+    void remove_pending(AccelerationStructurePrimitive& primitive) {
+        assert(is_pending(primitive));
+
+        AccelerationStructurePrimitive** slot = static_cast<AccelerationStructurePrimitive**>(primitive.m_node);
+        assert(*slot == &primitive);
+
+        *slot = m_pending.back();
+        (*slot)->m_node = slot;
+        m_pending.pop_back();
+
+        primitive.m_node = nullptr;
+    }
+
+    StaticBvh m_static;
+    std::vector<AccelerationStructurePrimitive*, CountAllocator<AccelerationStructurePrimitive*>> m_pending;
+    std::unordered_set<const AccelerationStructurePrimitive*, std::hash<const AccelerationStructurePrimitive*>, std::equal_to<const AccelerationStructurePrimitive*>, CountAllocator<const AccelerationStructurePrimitive*>> m_dynamic_primitives;
+    AccelerationStructure& m_dynamic;
+};
@@ -0,0 +1,293 @@
+#pragma once
+
+#include "acceleration_structure.h"
+#include "count_allocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+// Added primitives are kept unsorted until there's more than this fraction of sorted primitives (plus a constant).
+constexpr size_t SWEEP_AND_PRUNE_PENDING_DIVISOR = 8;
+constexpr size_t SWEEP_AND_PRUNE_MIN_PENDING = 64;
+
+// Swept ranges are widened by this much (relative to the scale of the values involved), so floating point error can't
+// exclude primitives that intersect the query.
+constexpr float SWEEP_AND_PRUNE_TOLERANCE = 1e-4f;
+
+struct SweepAndPruneEntry {
+    // Copy of the primitive's bounds, so queries don't touch the primitives until they're output.
+    aabbox3 bounds;
+
+    // Sort key, minimum X of the bounds.
+    float min_x;
+
+    // Index in the handle table, which points back at this entry.
+    uint32_t handle;
+
+    // Null when the primitive was removed.
+    AccelerationStructurePrimitive* primitive;
+};
+
+// Keeps primitives in a single array sorted by the minimum X of their bounds. Updates move a primitive to its new place
+// by insertion. Queries binary search the first primitive that may intersect and sweep until the last one.
+//
+// An update costs a shift and a handle write per entry it passes, so it's only cheap when primitives pass few others,
+// which depends on density as much as on speed. In the main benchmark (primitives move up to 0.8 units per frame) an
+// update passes about 13 entries at 65536 primitives and about 90 at 524288, which makes updating all of them about 4
+// and 30 times slower than in the octree respectively. Queuing far moving entries as pending ones halves the latter,
+// but slows down the former, since the pending ones have to be merged back about every eighth of the entries.
+//
+// Entries that move by insertion must update where their primitives point at. Primitives point at a handle that holds
+// the entry index instead, so moving an entry doesn't touch the primitive's memory.
+class SweepAndPruneAccelerationStructure : public AccelerationStructure {
+public:
+    SweepAndPruneAccelerationStructure(CountMemoryResource& memory_resource)
+        : m_entries(memory_resource)
+        , m_handles(memory_resource)
+        , m_free_handles(memory_resource)
+    {
+    }
+
+    void add(AccelerationStructurePrimitive& primitive) override {
+        uint32_t handle;
+
+        if (!m_free_handles.empty()) {
+            handle = m_free_handles.back();
+            m_free_handles.pop_back();
+        } else {
+            handle = static_cast<uint32_t>(m_handles.size());
+            m_handles.push_back(0);
+        }
+
+        primitive.m_node = reinterpret_cast<void*>(static_cast<uintptr_t>(handle));
+        m_handles[handle] = static_cast<uint32_t>(m_entries.size());
+
+        m_entries.push_back(get_entry(primitive, handle));
+
+        expand_max_extent(primitive.get_bounds());
+
+        if (m_entries.size() - m_sorted_count > m_sorted_count / SWEEP_AND_PRUNE_PENDING_DIVISOR + SWEEP_AND_PRUNE_MIN_PENDING) {
+            rebuild();
+        }
+    }
+
+    void remove(AccelerationStructurePrimitive& primitive) override {
+        uint32_t handle = get_handle(primitive);
+        uint32_t index = m_handles[handle];
+        assert(index < m_entries.size() && m_entries[index].primitive == &primitive);
+
+        // Removed entries are skipped by queries and dropped when there's too many of them. Their handle may be reused.
+        m_entries[index].primitive = nullptr;
+        m_removed_count++;
+
+        m_free_handles.push_back(handle);
+
+        if (m_removed_count > m_entries.size() / 2) {
+            rebuild();
+        }
+    }
+
+    void update(AccelerationStructurePrimitive& primitive) override {
+        uint32_t handle = get_handle(primitive);
+        uint32_t index = m_handles[handle];
+        assert(index < m_entries.size() && m_entries[index].primitive == &primitive);
+
+        SweepAndPruneEntry entry = get_entry(primitive, handle);
+
+        expand_max_extent(primitive.get_bounds());
+
+        if (index < m_sorted_count) {
+            // Removed entries keep their place, so they're moved past like any other entry. Entries in between are shifted
+            // by one as a block, then their handles are fixed in a single pass.
+            auto begin = m_entries.begin();
+            auto it = begin + index;
+
+            uint32_t destination = index;
+
+            while (destination > 0 && m_entries[destination - 1].min_x > entry.min_x) {
+                destination--;
+            }
+
+            while (destination + 1 < m_sorted_count && m_entries[destination + 1].min_x < entry.min_x) {
+                destination++;
+            }
+
+            if (destination < index) {
+                std::move_backward(begin + destination, it, it + 1);
+                update_handles(destination + 1, index + 1);
+            } else if (destination > index) {
+                std::move(it + 1, begin + destination + 1, it);
+                update_handles(index, destination);
+            }
+
+            index = destination;
+            m_handles[handle] = index;
+        }
+
+        m_entries[index] = entry;
+    }
+
+    using AccelerationStructure::query;
+
+    void query(const aabbox3& aabbox, std::vector<AccelerationStructurePrimitive*>& output) const override {
+        // Primitives that intersect the box start before its maximum and don't start much before its minimum.
+        collect_primitives(aabbox.center.x - aabbox.extent.x - 2.f * m_max_extent.x, aabbox.center.x + aabbox.extent.x, aabbox, output);
+    }
+
+    void query(const frustum& frustum, std::vector<AccelerationStructurePrimitive*>& output) const override {
+        float min_x;
+        float max_x;
+        get_center_range(frustum, min_x, max_x);
+
+        collect_primitives(min_x - m_max_extent.x, max_x, frustum, output);
+    }
+
+private:
+    static SweepAndPruneEntry get_entry(AccelerationStructurePrimitive& primitive, uint32_t handle) {
+        const aabbox3& bounds = primitive.get_bounds();
+        return SweepAndPruneEntry{ bounds, bounds.center.x - bounds.extent.x, handle, &primitive };
+    }
+
+    static bool compare_entries(const SweepAndPruneEntry& lhs, const SweepAndPruneEntry& rhs) {
+        return lhs.min_x < rhs.min_x;
+    }
+
+    static uint32_t get_handle(const AccelerationStructurePrimitive& primitive) {
+        return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(primitive.m_node));
+    }
+
+    void update_handles(uint32_t first, uint32_t last) {
+        for (uint32_t i = first; i < last; i++) {
+            if (m_entries[i].primitive != nullptr) {
+                m_handles[m_entries[i].handle] = i;
+            }
+        }
+    }
+
+    void expand_max_extent(const aabbox3& bounds) {
+        m_max_extent.x = std::max(m_max_extent.x, bounds.extent.x);
+        m_max_extent.y = std::max(m_max_extent.y, bounds.extent.y);
+        m_max_extent.z = std::max(m_max_extent.z, bounds.extent.z);
+    }
+
+    // Drops removed entries and merges pending entries into the sorted ones.
+    void rebuild() {
+        auto is_removed = [](const SweepAndPruneEntry& entry) {
+            return entry.primitive == nullptr;
+        };
+
+        auto sorted_end = std::remove_if(m_entries.begin(), m_entries.begin() + m_sorted_count, is_removed);
+        auto pending_end = std::remove_if(m_entries.begin() + m_sorted_count, m_entries.end(), is_removed);
+
+        m_entries.erase(std::move(m_entries.begin() + m_sorted_count, pending_end, sorted_end), m_entries.end());
+
+        std::sort(sorted_end, m_entries.end(), compare_entries);
+        std::inplace_merge(m_entries.begin(), sorted_end, m_entries.end(), compare_entries);
+
+        m_sorted_count = m_entries.size();
+        m_removed_count = 0;
+        m_max_extent = float3{ 0.f, 0.f, 0.f };
+
+        for (size_t i = 0; i < m_entries.size(); i++) {
+            m_handles[m_entries[i].handle] = static_cast<uint32_t>(i);
+            expand_max_extent(m_entries[i].bounds);
+        }
+    }
+
+    // Sweeps sorted entries with minimum X within the given range, and all pending entries.
+    template <typename Bounds>
+    void collect_primitives(float min_x, float max_x, const Bounds& bounds, std::vector<AccelerationStructurePrimitive*>& output) const {
+        float tolerance = SWEEP_AND_PRUNE_TOLERANCE * (1.f + std::abs(min_x) + std::abs(max_x));
+
+        auto sorted_end = m_entries.begin() + m_sorted_count;
+        auto it = std::lower_bound(m_entries.begin(), sorted_end, min_x - tolerance, [](const SweepAndPruneEntry& entry, float value) {
+            return entry.min_x < value;
+        });
+
+        for (; it != sorted_end && it->min_x <= max_x + tolerance; ++it) {
+            if (it->primitive != nullptr && intersect(it->bounds, bounds)) {
+                output.push_back(it->primitive);
+            }
+        }
+
+        for (it = sorted_end; it != m_entries.end(); ++it) {
+            if (it->primitive != nullptr && intersect(it->bounds, bounds)) {
+                output.push_back(it->primitive);
+            }
+        }
+    }
+
+    // Range of X of the centers of boxes that pass `intersect(const aabbox3&, const frustum&)`, given that no extent is
+    // greater than the maximum extent. Such centers are in front of all planes moved back by the largest projected
+    // extent, so the range is found among the vertices of the moved planes.
+    void get_center_range(const frustum& frustum, float& min_x, float& max_x) const {
+        plane planes[6];
+        float scale = 1.f;
+
+        for (size_t i = 0; i < 6; i++) {
+            const float3& normal = frustum.data[i].normal;
+            float3 abs_normal{ std::abs(normal.x), std::abs(normal.y), std::abs(normal.z) };
+
+            planes[i] = plane{ normal, frustum.data[i].distance + dot(m_max_extent, abs_normal) };
+            scale = std::max(scale, std::abs(planes[i].distance));
+        }
+
+        min_x = FLT_MAX;
+        max_x = -FLT_MAX;
+
+        for (size_t i = 0; i < 6; i++) {
+            for (size_t j = i + 1; j < 6; j++) {
+                for (size_t k = j + 1; k < 6; k++) {
+                    float3 jk = cross(planes[j].normal, planes[k].normal);
+                    float determinant = dot(planes[i].normal, jk);
+                    if (std::abs(determinant) < SWEEP_AND_PRUNE_TOLERANCE) {
+                        continue;
+                    }
+
+                    float3 ki = cross(planes[k].normal, planes[i].normal);
+                    float3 ij = cross(planes[i].normal, planes[j].normal);
+
+                    float x = -(planes[i].distance * jk.x + planes[j].distance * ki.x + planes[k].distance * ij.x) / determinant;
+                    float y = -(planes[i].distance * jk.y + planes[j].distance * ki.y + planes[k].distance * ij.y) / determinant;
+                    float z = -(planes[i].distance * jk.z + planes[j].distance * ki.z + planes[k].distance * ij.z) / determinant;
+
+                    float3 vertex{ x, y, z };
+                    float tolerance = SWEEP_AND_PRUNE_TOLERANCE * (scale + std::abs(x) + std::abs(y) + std::abs(z));
+
+                    bool is_vertex = true;
+                    for (const plane& plane : planes) {
+                        if (dot(vertex, plane.normal) + plane.distance < -tolerance) {
+                            is_vertex = false;
+                            break;
+                        }
+                    }
+
+                    if (is_vertex) {
+                        min_x = std::min(min_x, x);
+                        max_x = std::max(max_x, x);
+                    }
+                }
+            }
+        }
+
+        // Degenerate frustums are swept entirely.
+        if (min_x > max_x) {
+            min_x = -FLT_MAX;
+            max_x = FLT_MAX;
+        }
+    }
+
+    std::vector<SweepAndPruneEntry, CountAllocator<SweepAndPruneEntry>> m_entries;
+    std::vector<uint32_t, CountAllocator<uint32_t>> m_handles;
+    std::vector<uint32_t, CountAllocator<uint32_t>> m_free_handles;
+
+    // Entries before this are sorted, entries after this were added since the last rebuild.
+    size_t m_sorted_count = 0;
+    size_t m_removed_count = 0;
+
+    // Upper bound of the primitive extents, only shrinks on rebuild.
+    float3 m_max_extent = float3{ 0.f, 0.f, 0.f };
+};